@@ -5,6 +5,13 @@ set -euo pipefail
 say(){ printf "\033[1;34m>>> %s\033[0m\n" "$*"; }
 err(){ printf "\033[1;31m!!! ОШИБКА: %s\033[0m\n" "$*" >&2; exit 1; }
 
+# --optimized: сборка с LTO и PGO (scripts/build-optimized), дольше на
+# несколько минут тренировочного прогона
+OPTIMIZED=0
+if [ "${1-}" = "--optimized" ]; then
+  OPTIMIZED=1
+fi
+
 # ————— Определяем пользователя и домашний каталог —————
 if [ -n "${SUDO_USER-}" ]; then
   ORIG_USER="$SUDO_USER"
@@ -66,10 +73,14 @@ sudo apt install -y build-essential cmake pkg-config libvlc-dev libvlccore-dev l
 say "Собираем проект..."
 SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 BUILD_DIR="$SCRIPT_DIR/build"
-mkdir -p "$BUILD_DIR"
-cd "$BUILD_DIR"
-cmake .. -DCMAKE_BUILD_TYPE=Release
-make -j"$(nproc)"
+if [ "$OPTIMIZED" -eq 1 ]; then
+  bash "$SCRIPT_DIR/scripts/build-optimized" "$BUILD_DIR"
+else
+  mkdir -p "$BUILD_DIR"
+  cd "$BUILD_DIR"
+  cmake .. -DCMAKE_BUILD_TYPE=Release
+  make -j"$(nproc)"
+fi
 
 # ————— Поиск собранных плагинов —————
 say "Ищем скомпилированные .so в $BUILD_DIR/src"
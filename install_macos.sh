@@ -4,6 +4,12 @@ set -euo pipefail
 say(){ printf "\033[1;34m>>> %s\033[0m\n" "$*"; }
 err(){ printf "\033[1;31m!!! ОШИБКА: %s\033[0m\n" "$*" >&2; exit 1; }
 
+# --optimized: сборка с LTO и PGO (scripts/build-optimized)
+OPTIMIZED=0
+if [[ "${1-}" == "--optimized" ]]; then
+  OPTIMIZED=1
+fi
+
 # 1) Homebrew-зависимости
 if ! command -v brew &>/dev/null; then
   say "Устанавливаю Homebrew..."
@@ -40,12 +46,18 @@ cp -R "${VLC_APP}/Contents/MacOS/include/." "$SDK/include/" 2>/dev/null || true
 cp -R "${VLC_APP}/Contents/MacOS/lib/."     "$SDK/lib/"     2>/dev/null || true
 
 # 5) Сборка CMake
-say "Создаём папку build…"
-mkdir -p build && cd build
-say "Конфигурация CMake..."
-cmake .. -DCMAKE_PREFIX_PATH="$SDK"
-say "Сборка…"
-make -j"$(sysctl -n hw.ncpu)"
+if [[ $OPTIMIZED -eq 1 ]]; then
+  say "Оптимизированная сборка (LTO + PGO)…"
+  bash scripts/build-optimized build -DCMAKE_PREFIX_PATH="$SDK"
+  cd build
+else
+  say "Создаём папку build…"
+  mkdir -p build && cd build
+  say "Конфигурация CMake..."
+  cmake .. -DCMAKE_PREFIX_PATH="$SDK"
+  say "Сборка…"
+  make -j"$(sysctl -n hw.ncpu)"
+fi
 
 # 6) Копирование плагина
 PLUGIN=$(find src -maxdepth 1 -name "libaccess_bittorrent_plugin.*.so" -print -quit)
@@ -1,4 +1,7 @@
 #Requires -RunAsAdministrator
+# -Optimized: сборка с LTO (/GL, /LTCG). PGO — только в scripts/build-optimized
+# (Linux, macOS): тренировочный прогон MSVC профилировал бы benchmark, а не DLL
+param([switch]$Optimized)
 Set-StrictMode -Version Latest
 $ErrorActionPreference = 'Stop'
 
@@ -53,11 +56,15 @@ $Work='C:\build\vlc-bittorrent'
 if(Test-Path $Work){ Set-Location $Work; git pull } else { git clone $Repo $Work; Set-Location $Work }
 $Bld=Join-Path $Work 'build'; New-Item -ItemType Directory -Force $Bld | Out-Null; Set-Location $Bld
 
+$OptArgs = @()
+if($Optimized){ $OptArgs = @('-DCMAKE_BUILD_TYPE=Release', '-DBITTORRENT_OPTIMIZE=lto') }
+
 Say "Конфигурация CMake..."
 & cmake .. `
   -G "Ninja" `
   -DCMAKE_TOOLCHAIN_FILE="$env:VCPKG_ROOT\scripts\buildsystems\vcpkg.cmake" `
-  -DCMAKE_PREFIX_PATH="$SdkDir"
+  -DCMAKE_PREFIX_PATH="$SdkDir" `
+  @OptArgs
 Say "Сборка..."
 & cmake --build . --config Release
 
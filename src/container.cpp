@@ -0,0 +1,238 @@
+/*
+ * src/container.cpp
+ *
+ * Разбор только того, что нужно для поиска индекса: верхний уровень
+ * атомов MP4 и чанков RIFF, заголовок сегмента и SeekHead в MKV. Если
+ * заголовок следующего элемента уже за пределами прочитанного начала
+ * файла, смещение всё равно известно из размеров предыдущих элементов.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#include "container.h"
+
+// Больше индекс не заказываем: moov двухчасового фильма — единицы МиБ
+#define INDEX_MAX (32 * 1024 * 1024)
+// Размер Cues заранее не известен, пока не прочитан их заголовок
+#define CUES_GUESS (4 * 1024 * 1024)
+
+#define EBML_ID_HEADER    0x1A45DFA3
+#define EBML_ID_SEGMENT   0x18538067
+#define EBML_ID_SEEKHEAD  0x114D9B74
+#define EBML_ID_SEEK      0x4DBB
+#define EBML_ID_SEEKID    0x53AB
+#define EBML_ID_SEEKPOS   0x53AC
+#define EBML_ID_CUES      0x1C53BB6B
+#define EBML_ID_CLUSTER   0x1F43B675
+
+static uint64_t
+be(const uint8_t* p, size_t n)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static uint32_t
+le32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+           | (uint32_t)p[3] << 24;
+}
+
+static bool
+fourcc(const uint8_t* p, const char* cc)
+{
+    return memcmp(p, cc, 4) == 0;
+}
+
+static void
+add_range(std::vector<ByteRange>& out, int64_t off, int64_t len, int64_t filesz)
+{
+    len = std::min({ len, filesz - off, (int64_t)INDEX_MAX });
+    if (off >= 0 && len > 0)
+        out.push_back({ off, len });
+}
+
+// Верхний уровень атомов. moov после mdat: его заголовок лежит там, где
+// кончается mdat, а длина — до конца файла
+static bool
+mp4_ranges(const uint8_t* p, size_t len, int64_t filesz, std::vector<ByteRange>& out)
+{
+    if (len < 8 || !(fourcc(p + 4, "ftyp") || fourcc(p + 4, "moov")
+                     || fourcc(p + 4, "mdat") || fourcc(p + 4, "wide")))
+        return false;
+
+    int64_t off = 0;
+    bool after_mdat = false;
+    while (off < filesz) {
+        if (off + 16 > (int64_t)len) {
+            if (after_mdat)
+                add_range(out, off, filesz - off, filesz);
+            return true;
+        }
+        const uint8_t* box = p + off;
+        int64_t hdr = 8;
+        int64_t size = (int64_t)be(box, 4);
+        if (size == 1) {
+            size = (int64_t)be(box + 8, 8);
+            hdr = 16;
+        } else if (size == 0) {
+            size = filesz - off;
+        }
+        if (size < hdr)
+            return true;
+
+        if (fourcc(box + 4, "moov")) {
+            if (off + size > (int64_t)len)
+                add_range(out, off, size, filesz);
+            return true;
+        }
+        after_mdat = fourcc(box + 4, "mdat");
+        off += size;
+    }
+    return true;
+}
+
+// Идентификатор EBML: длина — по старшему биту, биты-маркеры остаются
+static bool
+ebml_id(const uint8_t* p, size_t len, size_t& pos, uint32_t& id)
+{
+    if (pos >= len)
+        return false;
+    size_t n = 1;
+    while (n <= 4 && !(p[pos] & (0x80 >> (n - 1))))
+        n++;
+    if (n > 4 || pos + n > len)
+        return false;
+    id = (uint32_t)be(p + pos, n);
+    pos += n;
+    return true;
+}
+
+// Размер EBML без маркера; все единицы — «неизвестен» (size = -1)
+static bool
+ebml_size(const uint8_t* p, size_t len, size_t& pos, int64_t& size)
+{
+    if (pos >= len)
+        return false;
+    size_t n = 1;
+    while (n <= 8 && !(p[pos] & (0x80 >> (n - 1))))
+        n++;
+    if (n > 8 || pos + n > len)
+        return false;
+    uint64_t v = p[pos] & (0xFF >> n);
+    bool unknown = v == (uint64_t)(0xFF >> n);
+    for (size_t i = 1; i < n; i++) {
+        v = v << 8 | p[pos + i];
+        unknown = unknown && p[pos + i] == 0xFF;
+    }
+    pos += n;
+    size = unknown ? -1 : (int64_t)v;
+    return true;
+}
+
+// Cues ищутся по SeekHead в начале сегмента; позиции в Seek отсчитываются
+// от начала данных сегмента
+static bool
+mkv_ranges(const uint8_t* p, size_t len, int64_t filesz, std::vector<ByteRange>& out)
+{
+    size_t pos = 0;
+    uint32_t id;
+    int64_t size;
+    if (!ebml_id(p, len, pos, id) || id != EBML_ID_HEADER)
+        return false;
+    if (!ebml_size(p, len, pos, size) || size < 0)
+        return true;
+    pos += (size_t)size;
+
+    if (!ebml_id(p, len, pos, id) || id != EBML_ID_SEGMENT)
+        return true;
+    if (!ebml_size(p, len, pos, size))
+        return true;
+    const size_t seg_start = pos;
+
+    while (ebml_id(p, len, pos, id) && ebml_size(p, len, pos, size)) {
+        if (id == EBML_ID_CUES || id == EBML_ID_CLUSTER || size < 0)
+            return true;
+        size_t end = pos + (size_t)size;
+        if (id != EBML_ID_SEEKHEAD) {
+            pos = end;
+            continue;
+        }
+
+        // Seek { SeekID, SeekPosition }
+        end = std::min(end, len);
+        while (ebml_id(p, end, pos, id) && ebml_size(p, end, pos, size) && size >= 0) {
+            size_t seek_end = std::min(pos + (size_t)size, end);
+            if (id != EBML_ID_SEEK) {
+                pos = seek_end;
+                continue;
+            }
+            uint32_t target = 0;
+            int64_t target_pos = -1;
+            while (ebml_id(p, seek_end, pos, id) && ebml_size(p, seek_end, pos, size)
+                   && size > 0 && size <= 8 && pos + (size_t)size <= seek_end) {
+                if (id == EBML_ID_SEEKID)
+                    target = (uint32_t)be(p + pos, (size_t)size);
+                else if (id == EBML_ID_SEEKPOS)
+                    target_pos = (int64_t)be(p + pos, (size_t)size);
+                pos += (size_t)size;
+            }
+            pos = seek_end;
+            if (target == EBML_ID_CUES && target_pos >= 0) {
+                int64_t off = (int64_t)seg_start + target_pos;
+                if (off + CUES_GUESS > (int64_t)len)
+                    add_range(out, off, CUES_GUESS, filesz);
+                return true;
+            }
+        }
+        return true;
+    }
+    return true;
+}
+
+// Чанки RIFF: idx1 идёт следом за списком movi
+static bool
+avi_ranges(const uint8_t* p, size_t len, int64_t filesz, std::vector<ByteRange>& out)
+{
+    if (len < 12 || !fourcc(p, "RIFF") || !fourcc(p + 8, "AVI "))
+        return false;
+
+    int64_t riff_end = std::min((int64_t)le32(p + 4) + 8, filesz);
+    int64_t off = 12;
+    bool after_movi = false;
+    while (off + 8 <= riff_end) {
+        if (off + 12 > (int64_t)len) {
+            if (after_movi)
+                add_range(out, off, riff_end - off, filesz);
+            return true;
+        }
+        const uint8_t* chunk = p + off;
+        int64_t size = le32(chunk + 4);
+        if (fourcc(chunk, "idx1")) {
+            if (off + 8 + size > (int64_t)len)
+                add_range(out, off, 8 + size, filesz);
+            return true;
+        }
+        after_movi = fourcc(chunk, "LIST") && fourcc(chunk + 8, "movi");
+        off += 8 + size + (size & 1);
+    }
+    return true;
+}
+
+std::vector<ByteRange>
+container_index_ranges(const char* head, size_t len, int64_t filesz)
+{
+    std::vector<ByteRange> out;
+    auto* p = reinterpret_cast<const uint8_t*>(head);
+    if (!mp4_ranges(p, len, filesz, out) && !mkv_ranges(p, len, filesz, out))
+        avi_ranges(p, len, filesz, out);
+    return out;
+}
@@ -0,0 +1,28 @@
+/*
+ * src/container.h
+ *
+ * Лёгкий разбор заголовка контейнера: где в файле лежит индекс, без
+ * которого демультиплексор VLC не начнёт воспроизведение и не перемотает.
+ * MP4 — атом moov (часто в конце файла), MKV — Cues по SeekHead, AVI —
+ * чанк idx1 после списка movi. Зная это по первым байтам файла, индекс
+ * можно запросить сразу, а не после нескольких зависимых чтений VLC.
+ */
+
+#ifndef VLC_BITTORRENT_CONTAINER_H
+#define VLC_BITTORRENT_CONTAINER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct ByteRange {
+    int64_t off;
+    int64_t len;
+};
+
+// Участки файла с индексом контейнера по его первым len байтам; пусто —
+// контейнер не распознан или индекс уже целиком в этих байтах
+std::vector<ByteRange>
+container_index_ranges(const char* head, size_t len, int64_t filesz);
+
+#endif
@@ -7,20 +7,27 @@
  *
  * 1.  При открытии (DataOpen) он регистрирует активный торрент через
  *     переменную VLC.
- * 2.  Предоставляет VLC функции для чтения (DataRead) и управления (DataControl).
+ * 2.  Предоставляет VLC функции для чтения (DataRead, DataBlock) и управления
+ *     (DataControl). Данные копируются из буфера куска в кэше Download
+ *     один раз — прямо в буфер VLC; блоки VLC с кэшем память не делят.
  * 3.  **Ключевая роль:** Реализует **правильную** функцию перемотки (DataSeek).
  *     Она не только обновляет внутреннюю позицию, но и:
  *      a) Вызывает vlc_stream_Seek(), чтобы уведомить ядро VLC о перемотке
  *         и сбросить внутренние часы (reference clock).
- *      b) Вызывает set_piece_priority(), чтобы приказать libtorrent немедленно
- *         начать загрузку данных с нового места с наивысшим приоритетом.
+ *      b) Вызывает set_playhead(): окно приоритетов и дедлайнов уходит
+ *         к новому месту, прежнее снимается; частые перемотки подряд
+ *         схлопываются в одну.
  * 4.  При закрытии (DataClose) он очищает переменную активного торрента.
+ *     Гистограммы стадий чтения (stats.h) при закрытии пишутся в журнал.
  * Реализация потока с использованием механизма кеширования VLC.
  * Гибридный подход: блокировка на старте, асинхронное чтение после.
  *
  * Ключевые моменты:
  *  - НЕТ vlc_stream_Seek() по source в DataSeek().
- *  - В DataRead() НИКОГДА не возвращаем 0, кроме реального EOF.
+ *  - При чтении НИКОГДА не сообщаем EOF, кроме реального конца файла.
+ *  - Пока куска нет, чтение возвращает -1 (NULL) без EOF после короткого
+ *    ожидания (см. Download::acquire()), и VLC повторяет чтение; стоп
+ *    прерывает ожидание сразу.
  *  - Большой PTS delay для сетевой буферизации (>= 10s).
  *  - Пауза: STREAM_CAN_CONTROL_PACE=false → VLC сам перестаёт читать;
  *    торрент продолжает качать.
@@ -31,9 +38,12 @@
 #endif
 
 #include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <tuple>
 #include <atomic>
 #include <stdio.h>          // snprintf
+#include <string.h>         // memcpy
 #include <inttypes.h>       // PRIu64, PRId64
 
 #include "vlc.h"
@@ -41,70 +51,120 @@
 #include "data.h"
 #include "download.h"
 
+// Наибольший блок, отдаваемый VLC за раз (не больше остатка куска)
+#define DATA_BLOCK_SIZE (4 * 1024 * 1024)
+
 struct data_sys {
     std::shared_ptr<Download> p_download;
     int i_file = 0;
+    int i_reader = Download::DEFAULT_READER;  // своя позиция в общем Download
+    uint64_t i_size = 0;  // размер файла: метаданные неизменны, спрашиваем один раз
     uint64_t i_pos = 0;
 
-    libvlc_int_t* libvlc = nullptr;
-    mtime_t       last_pub = 0;
-
     std::atomic<bool> is_initial_buffer_filled{false};
 
     // Для диагностики паузы (read() на это НЕ смотрит)
     std::atomic<bool> paused{false};
+
+    // Оценка скорости потребления для упреждающего чтения кусков
+    int64_t  caching_ms = 0;
+    mtime_t  rate_time = 0;
+    uint64_t rate_pos = 0;
+    int64_t  byte_rate = 0;
 };
 
-static ssize_t DataRead(stream_extractor_t* p_extractor, void* p_buf, size_t i_size) {
-    auto* s = reinterpret_cast<data_sys*>(p_extractor->p_sys);
-    if (!s || !s->p_download) {
-        return -1;
+// Раз в секунду обновляет сглаженную оценку скорости чтения (байт/с)
+static void UpdateStreamRate(data_sys* s, mtime_t now) {
+    if (s->rate_time == 0 || s->i_pos < s->rate_pos) {
+        s->rate_time = now;
+        s->rate_pos = s->i_pos;
+        return;
     }
 
-    // EOF
-    auto file_info = s->p_download->get_file(p_extractor->identifier);
-    if (s->i_pos >= file_info.second) {
-        return 0;
+    mtime_t dt = now - s->rate_time;
+    if (dt < CLOCK_FREQ) {
+        return;
     }
 
-    // Инициализация libVLC указателя
-    if (s->libvlc == nullptr) {
-        s->libvlc = p_extractor->obj.libvlc;
+    int64_t rate = (int64_t)((s->i_pos - s->rate_pos) * CLOCK_FREQ / (uint64_t)dt);
+    s->byte_rate = s->byte_rate > 0 ? (3 * s->byte_rate + rate) / 4 : rate;
+    s->rate_time = now;
+    s->rate_pos = s->i_pos;
+
+    s->p_download->set_stream_rate(s->byte_rate, s->caching_ms);
+}
+
+
+// Следующий участок файла: view куска в кэше Download, не дальше maxlen
+// и конца куска. Пустой view — данных пока нет (или ошибка), при конце
+// файла ещё и *eof
+static PieceView DataAcquire(stream_extractor_t* p_extractor, size_t maxlen, bool* eof) {
+    auto* s = reinterpret_cast<data_sys*>(p_extractor->p_sys);
+    if (!s || !s->p_download) {
+        return PieceView();
     }
 
-    // Периодическая публикация реального статуса торрента
-    mtime_t now = mdate();
-    if (now - s->last_pub >= 500000) { // ~0.5 сек
-        BtOverlayStatus st{};
-        if (s->p_download->query_status(st)) {
-            char ovbuf[256];
-            // Скорости — реальные из libtorrent; прогресс — общий прогресс торрента
-            snprintf(ovbuf, sizeof(ovbuf),
-                     "[BT] D:%lld KiB/s  U:%lld KiB/s  Peers:%d  Progress:%.2f%%",
-                     st.download_kib_s, st.upload_kib_s, st.peers, st.progress_pct);
-            var_SetString(VLC_OBJECT(s->libvlc), "bt_overlay_text", ovbuf);
-        }
-        s->last_pub = now;
+    // EOF
+    if (s->i_pos >= s->i_size) {
+        *eof = true;
+        return PieceView();
     }
 
-    // Основное чтение
+    // Статус для оверлея собирает поток сессии (см. Session::status_board()),
+    // путь чтения им не занят
     try {
-        ssize_t ret = s->p_download->read(s->i_file, (int64_t)s->i_pos,
-                                          static_cast<char*>(p_buf), i_size);
-        if (ret > 0) {
-            s->i_pos += ret;
-            if (!s->is_initial_buffer_filled.load()) {
-                s->is_initial_buffer_filled = true;
-                msg_Dbg(p_extractor, "Initial buffer filled, playback starting.");
-            }
+        PieceView view = s->p_download->acquire(s->i_reader, s->i_file,
+                                                (int64_t)s->i_pos, maxlen, nullptr);
+        if (view.size == 0)
+            return PieceView();
+
+        s->i_pos += view.size;
+        UpdateStreamRate(s, mdate());
+        if (!s->is_initial_buffer_filled.load()) {
+            s->is_initial_buffer_filled = true;
+            msg_Dbg(p_extractor, "Initial buffer filled, playback starting.");
         }
-        return ret;
+        return view;
     } catch (const std::runtime_error& e) {
-        msg_Err(p_extractor, "Fatal error during read (timeout?): %s", e.what());
-        return -1;
+        // Ожидание куска больше не кончается тайм-аутом: сюда приходят
+        // прерывание из VLC и ошибки чтения с диска
+        msg_Err(p_extractor, "Read failed: %s", e.what());
+        return PieceView();
     }
 }
 
+// Основное чтение (vlc_stream_Read): из куска в кэше сразу в буфер
+// вызывающего — одно копирование, как у ядра при блочном чтении, но сам
+// кэш VLC не достаётся
+static ssize_t DataRead(stream_extractor_t* p_extractor, void* p_buf, size_t i_len) {
+    bool eof = false;
+    PieceView view = DataAcquire(p_extractor, i_len, &eof);
+    if (view.size == 0) {
+        return eof ? 0 : -1;
+    }
+    if (p_buf) {
+        memcpy(p_buf, view.data, view.size);
+    }
+    return (ssize_t)view.size;
+}
+
+// vlc_stream_ReadBlock() отдаёт блок потребителю, и тот вправе менять
+// его на месте. Буфер куска общий с кэшем (другие читатели, повторные
+// перемотки), поэтому блок — всегда своя копия
+static block_t* DataBlock(stream_extractor_t* p_extractor, bool* eof) {
+    PieceView view = DataAcquire(p_extractor, DATA_BLOCK_SIZE, eof);
+    if (view.size == 0) {
+        return NULL;
+    }
+
+    block_t* p_block = block_Alloc(view.size);
+    if (!p_block) {
+        return NULL;
+    }
+    memcpy(p_block->p_buffer, view.data, view.size);
+    return p_block;
+}
+
 static int DataSeek(stream_extractor_t* p_extractor, uint64_t i_pos) {
     auto* s = reinterpret_cast<data_sys*>(p_extractor->p_sys);
     msg_Dbg(p_extractor, "Seek requested to position %" PRIu64, i_pos);
@@ -114,11 +174,18 @@ static int DataSeek(stream_extractor_t* p_extractor, uint64_t i_pos) {
     }
 
     s->i_pos = i_pos;
+    s->rate_time = 0;
     s->is_initial_buffer_filled = false;
     msg_Dbg(p_extractor, "Resetting buffer status for seeking.");
 
+    // Окно и дедлайны — от новой позиции, по уже измеренной скорости
+    // потока: битрейт содержимого от перемотки не меняется
     if (s->p_download) {
-        s->p_download->set_piece_priority(s->i_file, (int64_t)s->i_pos, 50 * 1024 * 1024, 7);
+        try {
+            s->p_download->set_playhead(s->i_reader, s->i_file, (int64_t)s->i_pos);
+        } catch (const std::runtime_error& e) {
+            msg_Warn(p_extractor, "Failed to move playhead: %s", e.what());
+        }
     }
 
     return VLC_SUCCESS;
@@ -134,7 +201,7 @@ static int DataControl(stream_extractor_t* p_extractor, int i_query, va_list arg
             return VLC_SUCCESS;
 
         case STREAM_GET_SIZE:
-            *va_arg(args, uint64_t*) = s->p_download->get_file(p_extractor->identifier).second;
+            *va_arg(args, uint64_t*) = s->i_size;
             return VLC_SUCCESS;
 
         case STREAM_GET_PTS_DELAY: {
@@ -168,24 +235,46 @@ static int DataControl(stream_extractor_t* p_extractor, int i_query, va_list arg
 }
 
 int DataOpen(vlc_object_t* p_obj) {
-    // Инициализация переменной на libVLC
+    // Адрес доски статуса для оверлея: отдельный модуль находит её
+    // через переменную libVLC и дальше читает без блокировок
     libvlc_int_t *libvlc = p_obj->obj.libvlc;
-    var_Create(VLC_OBJECT(libvlc), "bt_overlay_text", VLC_VAR_STRING);
-    var_SetString(VLC_OBJECT(libvlc), "bt_overlay_text", "[BT] Starting...");
+    var_Create(VLC_OBJECT(libvlc), STATUS_BOARD_VAR, VLC_VAR_ADDRESS);
+    var_SetAddress(VLC_OBJECT(libvlc), STATUS_BOARD_VAR, &Session::status_board());
 
     auto* p_extractor = reinterpret_cast<stream_extractor_t*>(p_obj);
-    auto md = std::make_unique<char[]>(0x100000);
-    ssize_t mdsz = vlc_stream_Read(p_extractor->source, md.get(), 0x100000);
-    if (mdsz < 0) return VLC_EGENERIC;
+    std::vector<char> md;
+    if (!read_stream(p_extractor->source, md, METADATA_MAX_SIZE)) return VLC_EGENERIC;
 
     auto s = new (std::nothrow) data_sys();
     if (!s) return VLC_ENOMEM;
 
+    Session::set_state_directory(get_cache_directory(p_obj));
+    Session::get()->set_profile(get_profile(p_obj));
+
     try {
-        s->p_download = Download::get_download(md.get(), (size_t)mdsz,
+        StorageOptions storage;
+        if (get_memory_storage(p_obj)) {
+            storage.mode = StorageMode::memory;
+            storage.memory_limit = get_memory_limit(p_obj);
+        }
+        s->p_download = Download::get_download(md.data(), md.size(),
                                                get_download_directory(p_obj),
-                                               get_keep_files(p_obj));
-        s->i_file = s->p_download->get_file(p_extractor->identifier).first;
+                                               get_cache_directory(p_obj),
+                                               get_keep_files(p_obj), storage);
+        if (storage.mode == StorageMode::memory && !s->p_download->in_memory())
+            msg_Warn(p_obj, "Pieces are stored in the download directory: "
+                     "memory storage is off with kept files or libtorrent 2.0");
+        s->p_download->set_piece_cache_size(get_piece_cache_size(p_obj));
+        s->p_download->set_partial_pieces(get_partial_pieces(p_obj));
+        s->p_download->set_next_file_prefetch(get_next_file_prefetch(p_obj));
+        s->p_download->set_foreground(true);
+        // Тот же нижний предел, что и в STREAM_GET_PTS_DELAY
+        s->caching_ms = var_InheritInteger(p_obj, "network-caching");
+        if (s->caching_ms < 10000) s->caching_ms = 10000;
+        std::tie(s->i_file, s->i_size) = s->p_download->get_file(p_extractor->identifier);
+        // Тот же торрент может читать и другой поток (звук из соседнего
+        // файла, миниатюры): у каждого своё окно приоритетов
+        s->i_reader = s->p_download->add_reader();
     } catch (const std::runtime_error& e) {
         msg_Err(p_extractor, "Failed to add download: %s", e.what());
         delete s;
@@ -193,7 +282,10 @@ int DataOpen(vlc_object_t* p_obj) {
     }
 
     p_extractor->p_sys = s;
+    // vlc_stream_Read() идёт через pf_read, vlc_stream_ReadBlock() — через
+    // pf_block
     p_extractor->pf_read = DataRead;
+    p_extractor->pf_block = DataBlock;
     p_extractor->pf_seek = DataSeek;
     p_extractor->pf_control = DataControl;
 
@@ -202,13 +294,20 @@ int DataOpen(vlc_object_t* p_obj) {
 }
 
 void DataClose(vlc_object_t* p_obj) {
-    // Очистим строку оверлея
-    libvlc_int_t *libvlc = p_obj->obj.libvlc;
-    var_SetString(VLC_OBJECT(libvlc), "bt_overlay_text", "");
-
+    // Оверлей очистится сам: отпущенный Download уходит в background
     auto* p_extractor = reinterpret_cast<stream_extractor_t*>(p_obj);
     auto* s = reinterpret_cast<data_sys*>(p_extractor->p_sys);
     if (s) {
+        // По журналу можно понять, во что упирались зависания: сеть
+        // (piece_wait), диск (read_piece) или поток сессии (alert_*)
+        if (s->p_download) {
+            std::istringstream stats(s->p_download->stats_text());
+            std::string line;
+            while (std::getline(stats, line)) {
+                msg_Dbg(p_obj, "Stats: %s", line.c_str());
+            }
+            s->p_download->remove_reader(s->i_reader);
+        }
         delete s;
     }
     p_extractor->p_sys = nullptr;
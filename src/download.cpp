@@ -18,22 +18,23 @@
  *     выделить время на кеширование. VLC запускает специальный поток
  *     буферизации и из него вызывает `DataRead`.
  *
- * 2.  **Блокировка:** `DataRead` вызывает `Download::read()`. Эта функция
- *     проверяет, есть ли нужный кусок торрента на диске. Если нет, она
- *     **блокирует поток**, ожидая, пока libtorrent скачает этот кусок.
+ * 2.  **Блокировка:** `DataBlock` вызывает `Download::acquire()`. Эта
+ *     функция проверяет, есть ли нужный кусок торрента на диске. Если нет,
+ *     она **блокирует поток**, ожидая, пока libtorrent скачает этот кусок.
  *
- * 3.  **Защита от зависания:** Блокировка не вечна. Она ограничена
- *     тайм-аутом `PIECE_READ_TIMEOUT` (например, 60 секунд). Если за это
- *     время кусок не скачался (торрент "мертвый" или очень медленный),
- *     функция бросает исключение `std::runtime_error`.
+ * 3.  **Короткое ожидание:** Блокировка длится не дольше
+ *     `PIECE_WAIT_SLICE_MS` и прерывается из VLC (стоп, закрытие). Если
+ *     кусок за это время не скачался, `acquire()` возвращает пустой view
+ *     с `pending`, а процент загрузки куска публикуется как буферизация.
  *
- * 4.  **Обработка ошибки:** Исключение перехватывается в `data.cpp`, который
- *     возвращает VLC ошибку (-1). VLC корректно сообщает пользователю,
- *     что не может открыть источник.
+ * 4.  **Повтор:** `data.cpp` возвращает VLC NULL без EOF, и VLC повторяет
+ *     чтение. Медленный торрент воспроизведение не обрывает: оно ждёт,
+ *     пока не придут данные или пользователь не остановит его.
  *
- * 5.  **Успешное чтение:** Если кусок скачался вовремя, `read()` читает из
- *     него данные и возвращает их. VLC заполняет свой кеш и начинает
- *     воспроизведение, как только буфер заполнен.
+ * 5.  **Успешное чтение:** Как только кусок есть, `acquire()` отдаёт всё,
+ *     что есть подряд до конца куска, не дожидаясь остального запроса.
+ *     VLC заполняет свой кеш и начинает воспроизведение, как только
+ *     буфер заполнен.
  *
  * Этот подход решает главную дилемму: он позволяет дождаться данных на
  * старте (удовлетворяя требование VLC), но делает это в безопасном потоке,
@@ -44,19 +45,34 @@
 #include "config.h"
 #endif
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
 #include <future>
 #include <limits>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <thread>
 #include <iterator>
 #include <vector>
 #include <map>              // ← используется для кэша get_download()
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
+#include "container.h"
 #include "download.h"
+#include "metadatacache.h"
 #include "session.h"
+#include "torrentregistry.h"
 #include "vlc.h"
 
 #pragma GCC diagnostic push
@@ -64,10 +80,11 @@
 #pragma GCC diagnostic ignored "-Wconversion"
 #include <libtorrent/alert.hpp>
 #include <libtorrent/alert_types.hpp>
-#include <libtorrent/create_torrent.hpp>
 #include <libtorrent/hex.hpp>
 #include <libtorrent/magnet_uri.hpp>
+#include <libtorrent/peer_info.hpp>
 #include <libtorrent/peer_request.hpp>
+#include <libtorrent/read_resume_data.hpp>
 #include <libtorrent/session.hpp>
 #include <libtorrent/sha1_hash.hpp>
 #include <libtorrent/torrent_handle.hpp>
@@ -75,6 +92,7 @@
 #include <libtorrent/torrent_status.hpp>  // ← добавлено
 #include <libtorrent/version.hpp>
 #include <libtorrent/torrent_flags.hpp>
+#include <libtorrent/write_resume_data.hpp>
 #pragma GCC diagnostic pop
 
 #define D(x)
@@ -87,7 +105,55 @@
 #define PRIO_HIGHER 6
 #define PRIO_HIGH 5
 
+// Дольше одного ожидания куска VLC не блокируется: дальше — повтор
+#define PIECE_WAIT_SLICE_MS 1000
+// Копирующий read() повторяет ожидания не дольше этого (с)
 #define PIECE_READ_TIMEOUT 60
+#define ADD_TORRENT_TIMEOUT 30
+
+// Как часто (в секундах) сохранять fast-resume во время загрузки
+#define RESUME_SAVE_INTERVAL 60
+
+// Сколько секунд Download живёт после закрытия последнего потока
+#define TEARDOWN_GRACE 5
+
+// Фоновая загрузка метаданных: параллельность и предел ожидания (с)
+#define PREFETCH_THREADS 4
+#define PREFETCH_TIMEOUT 120
+
+// Размер блока запроса к пирам и период перепроверки очереди загрузки
+// при ожидании куска
+#define BLOCK_SIZE (16 * kB)
+#define PARTIAL_POLL_MS 100
+
+#define PIECE_CACHE_DEFAULT (64 * MB)
+
+// Окно приоритетов вокруг позиции воспроизведения и его срочная часть
+// с дедлайнами. Пока скорость потока неизвестна — 5% файла (не меньше
+// 32 МиБ) и 8 МиБ; потом — WINDOW_LOOKAHEAD_S секунд потока, из которых
+// срочные — network-caching
+#define WINDOW_MIN (32 * MB)
+#define WINDOW_URGENT (8 * MB)
+#define WINDOW_URGENT_PIECES 2
+#define WINDOW_URGENT_MAX_PIECES 64
+#define WINDOW_LOOKAHEAD_S 120
+#define DEADLINE_STEP_MS 500
+
+// Перемотки чаще этого считаются одним протаскиванием ползунка
+#define SEEK_DEBOUNCE_MS 200
+
+// Срок первого куска индекса контейнера (moov, Cues, idx1)
+#define INDEX_DEADLINE_MS 1000
+
+// Прогрев следующего файла: столько секунд потока от его начала (не
+// меньше NEXT_FILE_HEAD_MIN) и столько первых байтов для поиска индекса
+#define NEXT_FILE_HEAD_S 30
+#define NEXT_FILE_HEAD_MIN (8 * MB)
+#define NEXT_FILE_SNIFF (256 * kB)
+
+// Границы глубины упреждающего чтения, в кусках
+#define READ_AHEAD_MIN 1
+#define READ_AHEAD_MAX 32
 
 namespace lt = libtorrent;
 
@@ -103,29 +169,29 @@ private:
     }
 };
 
+// Подписывает слушателя на ключи, которые он сам перечисляет в keys(),
+// и отписывает при выходе из области видимости
 template <typename T> class AlertSubscriber {
 public:
     AlertSubscriber(std::shared_ptr<Session> dl, T* pr)
-        : m_session(dl), m_promise(pr)
-    { m_session->register_alert_listener(m_promise); }
-    ~AlertSubscriber() { m_session->unregister_alert_listener(m_promise); }
+        : m_session(dl), m_promise(pr), m_keys(pr->keys())
+    { for (auto& k : m_keys) m_session->subscribe(k, m_promise); }
+    ~AlertSubscriber() { for (auto& k : m_keys) m_session->unsubscribe(k, m_promise); }
 private:
     std::shared_ptr<Session> m_session; T* m_promise;
+    std::vector<AlertKey> m_keys;
 };
 
 using ReadValue = std::pair<boost::shared_array<char>, int>;
 
 class ReadPiecePromise : public std::promise<ReadValue>, public Alert_Listener {
 public:
-    ReadPiecePromise(lt::sha1_hash ih, int p) : m_ih(ih), m_piece(p) {}
+    ReadPiecePromise(lt::sha1_hash ih, lt::piece_index_t p) : m_ih(ih), m_piece(p) {}
+    std::vector<AlertKey> keys() const {
+        return { { lt::read_piece_alert::alert_type, m_ih, static_cast<int>(m_piece) } };
+    }
     void handle_alert(lt::alert* a) override {
         if (auto* x = lt::alert_cast<lt::read_piece_alert>(a)) {
-#if LIBTORRENT_VERSION_NUM >= 20000
-            if (x->handle.info_hashes().v1 != m_ih) return;
-#else
-            if (x->handle.info_hash() != m_ih) return;
-#endif
-            if (x->piece != m_piece) return;
             if (x->error) {
                 set_exception(std::make_exception_ptr(std::runtime_error("read failed")));
             } else {
@@ -134,50 +200,57 @@ public:
         }
     }
 private:
-    lt::sha1_hash m_ih; int m_piece;
+    lt::sha1_hash m_ih; lt::piece_index_t m_piece;
 };
 
 class DownloadPiecePromise : public std::promise<void>, public Alert_Listener {
 public:
-    DownloadPiecePromise(lt::sha1_hash ih, int p) : m_ih(ih), m_piece(p) {}
+    DownloadPiecePromise(lt::sha1_hash ih, lt::piece_index_t p) : m_ih(ih), m_piece(p) {}
+    std::vector<AlertKey> keys() const {
+        return { { lt::piece_finished_alert::alert_type, m_ih, static_cast<int>(m_piece) } };
+    }
     void handle_alert(lt::alert* a) override {
-        if (auto* x = lt::alert_cast<lt::piece_finished_alert>(a)) {
-#if LIBTORRENT_VERSION_NUM >= 20000
-            if (x->handle.info_hashes().v1 != m_ih) return;
-#else
-            if (x->handle.info_hash() != m_ih) return;
-#endif
-            if (x->piece_index != m_piece) return; set_value();
-        }
+        if (lt::alert_cast<lt::piece_finished_alert>(a)) set_value();
+    }
+private:
+    lt::sha1_hash m_ih; lt::piece_index_t m_piece;
+};
+
+// Будит ожидающего, когда пир прислал очередной блок куска
+class BlockProgress : public Alert_Listener {
+public:
+    BlockProgress(lt::sha1_hash ih, lt::piece_index_t p) : m_ih(ih), m_piece(p) {}
+    std::vector<AlertKey> keys() const {
+        return { { lt::block_finished_alert::alert_type, m_ih, static_cast<int>(m_piece) } };
+    }
+    void handle_alert(lt::alert*) override {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        m_blocks++;
+        m_cv.notify_all();
+    }
+    template <typename Duration> void wait_for(Duration d) {
+        std::unique_lock<std::mutex> lk(m_mtx);
+        uint64_t seen = m_blocks;
+        m_cv.wait_for(lk, d, [&] { return m_blocks != seen; });
     }
 private:
-    lt::sha1_hash m_ih; int m_piece;
+    lt::sha1_hash m_ih; lt::piece_index_t m_piece;
+    std::mutex m_mtx; std::condition_variable m_cv; uint64_t m_blocks = 0;
 };
 
 class MetadataDownloadPromise : public std::promise<void>, public Alert_Listener {
 public:
     explicit MetadataDownloadPromise(lt::sha1_hash ih) : m_ih(ih) {}
+    std::vector<AlertKey> keys() const {
+        return { { lt::torrent_error_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+                 { lt::metadata_failed_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+                 { lt::metadata_received_alert::alert_type, m_ih, AlertKey::ANY_PIECE } };
+    }
     void handle_alert(lt::alert* a) override {
-        if (auto* x = lt::alert_cast<lt::torrent_error_alert>(a)) {
-#if LIBTORRENT_VERSION_NUM >= 20000
-            if (x->handle.info_hashes().v1 != m_ih) return;
-#else
-            if (x->handle.info_hash() != m_ih) return;
-#endif
+        if (lt::alert_cast<lt::torrent_error_alert>(a)
+            || lt::alert_cast<lt::metadata_failed_alert>(a)) {
             set_exception(std::make_exception_ptr(std::runtime_error("metadata failed")));
-        } else if (auto* x = lt::alert_cast<lt::metadata_failed_alert>(a)) {
-#if LIBTORRENT_VERSION_NUM >= 20000
-            if (x->handle.info_hashes().v1 != m_ih) return;
-#else
-            if (x->handle.info_hash() != m_ih) return;
-#endif
-            set_exception(std::make_exception_ptr(std::runtime_error("metadata failed")));
-        } else if (auto* x = lt::alert_cast<lt::metadata_received_alert>(a)) {
-#if LIBTORRENT_VERSION_NUM >= 20000
-            if (x->handle.info_hashes().v1 != m_ih) return;
-#else
-            if (x->handle.info_hash() != m_ih) return;
-#endif
+        } else if (lt::alert_cast<lt::metadata_received_alert>(a)) {
             set_value();
         }
     }
@@ -188,26 +261,325 @@ private:
 class RemovePromise : public std::promise<void>, public Alert_Listener {
 public:
     explicit RemovePromise(lt::sha1_hash ih) : m_ih(ih) {}
+    std::vector<AlertKey> keys() const {
+        return { { lt::torrent_removed_alert::alert_type, m_ih, AlertKey::ANY_PIECE } };
+    }
     void handle_alert(lt::alert* a) override {
-        if (auto* x = lt::alert_cast<lt::torrent_removed_alert>(a)) {
+        if (lt::alert_cast<lt::torrent_removed_alert>(a)) set_value();
+    }
+private:
+    lt::sha1_hash m_ih;
+};
+
+static lt::sha1_hash atp_infohash(const lt::add_torrent_params& atp)
+{
 #if LIBTORRENT_VERSION_NUM >= 20000
-            if (x->info_hashes.v1 != m_ih) return;
+    return atp.ti ? atp.ti->info_hashes().v1 : atp.info_hashes.v1;
 #else
-            if (x->info_hash != m_ih) return;
+    return atp.ti ? atp.ti->info_hash() : atp.info_hash;
 #endif
-            set_value();
+}
+
+// Кто сейчас держит infohash. Один Download обслуживает всех читателей
+// торрента; новый создаётся, только когда прежний удалён совсем (до тех
+// пор libtorrent его не забыл), а пока прежний отложен в DownloadReaper,
+// его забирают обратно. Мьютекс таблицы держится только на время поиска:
+// торрент добавляется (до ADD_TORRENT_TIMEOUT) без него, и открытие
+// другого infohash этого не ждёт
+class DownloadTable {
+public:
+    static DownloadTable& get() { static DownloadTable inst; return inst; }
+
+    // metadata_only — объект нужен только ради метаданных: его можно
+    // отдать любому открытию, но сам он ничей объект не забирает
+    std::shared_ptr<Download>
+    open(const lt::sha1_hash& ih, bool metadata_only,
+         const std::function<Download*()>& create);
+
+    // Из Download::Lease: объект создан / удалён
+    void acquire(const lt::sha1_hash& ih) {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        m_entries[ih].alive = true;
+    }
+
+    void release(const lt::sha1_hash& ih) {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        auto it = m_entries.find(ih);
+        if (it == m_entries.end()) return;
+        it->second.alive = false;
+        if (!it->second.opening && it->second.dl.expired())
+            m_entries.erase(it);
+        m_cv.notify_all();
+    }
+
+private:
+    struct Entry {
+        std::weak_ptr<Download> dl;
+        bool opening = false;   // объект создаётся, торрент добавляется
+        bool alive = false;     // объект существует, в том числе отложенный
+        bool metadata_only = false;
+    };
+
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::map<lt::sha1_hash, Entry> m_entries;
+};
+
+// Отложенное удаление Download. Последний shared_ptr отдаёт объект сюда,
+// и торрент живёт ещё TEARDOWN_GRACE секунд: если за это время откроют
+// другой файл того же торрента, get_download() заберёт объект обратно
+// без повторного добавления, проверки и поиска пиров. Иначе деструктор
+// (с ожиданием torrent_removed_alert) выполняется в потоке пула, а не в
+// потоке ввода VLC
+class DownloadReaper {
+public:
+    static DownloadReaper& get() { static DownloadReaper inst; return inst; }
+
+    void park(const lt::sha1_hash& ih, Download* dl) {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        m_parked[ih] = { dl, clock::now() + std::chrono::seconds(TEARDOWN_GRACE) };
+        m_cv.notify_all();
+    }
+
+    // Удалить без отсрочки, но не в вызывающем потоке
+    void dispose(Download* dl) {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        m_doomed.push_back(dl);
+        m_cv.notify_all();
+    }
+
+    Download* revive(const lt::sha1_hash& ih) {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        auto it = m_parked.find(ih);
+        if (it == m_parked.end()) return nullptr;
+        Download* dl = it->second.first;
+        m_parked.erase(it);
+        return dl;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // Отложенные объекты удаляются и при выгрузке плагина, из деструктора;
+    // таблица, которой они сообщают об удалении, должна пережить пул
+    DownloadReaper() : m_thread(&DownloadReaper::run, this) { DownloadTable::get(); }
+    ~DownloadReaper() {
+        { std::lock_guard<std::mutex> lg(m_mtx); m_quit = true; }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lk(m_mtx);
+        while (!m_quit) {
+            auto now = clock::now();
+            auto next = clock::time_point::max();
+            std::vector<Download*> expired = std::move(m_doomed);
+            m_doomed.clear();
+            for (auto it = m_parked.begin(); it != m_parked.end();) {
+                if (it->second.second <= now) {
+                    expired.push_back(it->second.first);
+                    it = m_parked.erase(it);
+                } else {
+                    next = std::min(next, it->second.second);
+                    ++it;
+                }
+            }
+            if (!expired.empty()) {
+                lk.unlock();
+                for (auto* dl : expired) delete dl;
+                lk.lock();
+                continue;
+            }
+            if (next == clock::time_point::max()) m_cv.wait(lk);
+            else m_cv.wait_until(lk, next);
+        }
+
+        // Выгрузка плагина: ждать повторного открытия уже некому
+        auto rest = std::move(m_parked);
+        m_parked.clear();
+        auto doomed = std::move(m_doomed);
+        m_doomed.clear();
+        lk.unlock();
+        for (auto& e : rest) delete e.second.first;
+        for (auto* dl : doomed) delete dl;
+    }
+
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    bool m_quit = false;
+    std::map<lt::sha1_hash, std::pair<Download*, clock::time_point>> m_parked;
+    std::vector<Download*> m_doomed;
+    std::thread m_thread;
+};
+
+std::shared_ptr<Download>
+DownloadTable::open(const lt::sha1_hash& ih, bool metadata_only,
+                    const std::function<Download*()>& create)
+{
+    DownloadReaper& reaper = DownloadReaper::get();
+    // Объект ради метаданных создан с keep, без fast-resume и хранилища в
+    // памяти: отложить его — значит отдать следующему открытию данных
+    // чужие настройки
+    auto wrap = [ih](Download* raw, bool md_only) {
+        return std::shared_ptr<Download>(raw, [ih, md_only](Download* p) {
+            p->set_foreground(false);
+            if (md_only)
+                DownloadReaper::get().dispose(p);
+            else
+                DownloadReaper::get().park(ih, p);
+        });
+    };
+
+    std::unique_lock<std::mutex> lk(m_mtx);
+    for (;;) {
+        Entry& e = m_entries[ih];
+        if (auto dl = e.dl.lock()) {
+            if (metadata_only || !e.metadata_only)
+                return dl;
+            // Метаданные уже есть у открывающего данные, так что их
+            // загрузка вот-вот отпустит объект
+            dl.reset();
+            m_cv.wait_for(lk, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        if (e.opening) {
+            // Торрент добавляет другое открытие — объект будет общий
+            m_cv.wait(lk);
+            continue;
+        }
+
+        if (!e.alive) {
+            e.opening = true;
+            lk.unlock();
+            Download* raw;
+            try {
+                raw = create();
+            } catch (...) {
+                lk.lock();
+                Entry& failed = m_entries[ih];
+                failed.opening = false;
+                if (!failed.alive)
+                    m_entries.erase(ih);
+                m_cv.notify_all();
+                throw;
+            }
+            lk.lock();
+            Entry& created = m_entries[ih];
+            created.opening = false;
+            created.metadata_only = metadata_only;
+            auto dl = wrap(raw, metadata_only);
+            created.dl = dl;
+            m_cv.notify_all();
+            return dl;
+        }
+
+        // Отложены только объекты открытий данных
+        if (Download* raw = reaper.revive(ih)) {
+            auto dl = wrap(raw, false);
+            e.metadata_only = false;
+            e.dl = dl;
+            return dl;
+        }
+        // Последняя ссылка уже отпущена, но объект ещё не дошёл до пула
+        // или уже удаляется: release() разбудит, когда infohash свободен
+        m_cv.wait_for(lk, std::chrono::milliseconds(10));
+    }
+}
+
+Download::Lease::Lease(const lt::sha1_hash& i) : ih(i)
+{
+    DownloadTable::get().acquire(ih);
+}
+
+Download::Lease::~Lease()
+{
+    DownloadTable::get().release(ih);
+}
+
+class AddTorrentPromise : public std::promise<lt::torrent_handle>, public Alert_Listener {
+public:
+    explicit AddTorrentPromise(lt::sha1_hash ih) : m_ih(ih) {}
+    std::vector<AlertKey> keys() const {
+        return { { lt::add_torrent_alert::alert_type, m_ih, AlertKey::ANY_PIECE } };
+    }
+    void handle_alert(lt::alert* a) override {
+        auto* x = lt::alert_cast<lt::add_torrent_alert>(a);
+        if (!x) return;
+        try {
+            if (x->error)
+                set_exception(std::make_exception_ptr(std::runtime_error(
+                    "Failed to add torrent: " + x->error.message())));
+            else
+                set_value(x->handle);
+        } catch (const std::future_error&) {}
+    }
+private:
+    lt::sha1_hash m_ih;
+};
+
+class SaveResumePromise : public std::promise<lt::add_torrent_params>, public Alert_Listener {
+public:
+    explicit SaveResumePromise(lt::sha1_hash ih) : m_ih(ih) {}
+    std::vector<AlertKey> keys() const {
+        return { { lt::save_resume_data_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+                 { lt::save_resume_data_failed_alert::alert_type, m_ih, AlertKey::ANY_PIECE } };
+    }
+    void handle_alert(lt::alert* a) override {
+        try {
+            if (auto* x = lt::alert_cast<lt::save_resume_data_alert>(a))
+                set_value(x->params);
+            else if (lt::alert_cast<lt::save_resume_data_failed_alert>(a))
+                set_exception(std::make_exception_ptr(
+                    std::runtime_error("Failed to save resume data")));
+        } catch (const std::future_error&) {}
+    }
+private:
+    lt::sha1_hash m_ih;
+};
+
+class CheckedPromise : public std::promise<void>, public Alert_Listener {
+public:
+    explicit CheckedPromise(lt::sha1_hash ih) : m_ih(ih) {}
+    std::vector<AlertKey> keys() const {
+        return { { lt::torrent_checked_alert::alert_type, m_ih, AlertKey::ANY_PIECE } };
+    }
+    void handle_alert(lt::alert* a) override {
+        // Повторная проверка (force_recheck) пришлёт алерт ещё раз
+        if (lt::alert_cast<lt::torrent_checked_alert>(a)) {
+            try { set_value(); } catch (const std::future_error&) {}
         }
     }
 private:
     lt::sha1_hash m_ih;
 };
 
-Download::Download(std::mutex& mtx, lt::add_torrent_params& atp, bool k)
-    : m_lock(mtx), m_keep(k), m_session(Session::get())
+Download::Download(lt::add_torrent_params& atp, bool k, std::string resume_path,
+                   StorageHint hint)
+    : m_lease(atp_infohash(atp)), m_keep(k), m_session(Session::get())
+    , m_cache(PIECE_CACHE_DEFAULT)
+    , m_resume_path(std::move(resume_path))
+    , m_resume_time(std::chrono::steady_clock::now())
+    , m_storage_hint(std::move(hint))
 {
     D(printf("%s:%d: %s (from atp)\n", __FILE__, __LINE__, __func__));
 
-    m_th = m_session->add_torrent(atp);
+    m_ih = atp_infohash(atp);
+
+    {
+        AddTorrentPromise addprom(m_ih);
+        AlertSubscriber<AddTorrentPromise> sub(m_session, &addprom);
+        auto f = addprom.get_future();
+        m_session->async_add_torrent(atp);
+        if (f.wait_for(std::chrono::seconds(ADD_TORRENT_TIMEOUT)) == std::future_status::timeout) {
+            // Добавление всё равно состоится: торрент без Download
+            // остался бы в сессии навсегда
+            m_session->remove_torrent(m_ih, m_keep);
+            throw std::runtime_error("Timeout adding torrent");
+        }
+        m_th = f.get();
+    }
     if (!m_th.is_valid())
         throw std::runtime_error("Failed to add torrent");
 
@@ -217,14 +589,65 @@ Download::Download(std::mutex& mtx, lt::add_torrent_params& atp, bool k)
         m_th.replace_trackers(announce_entries);
     }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    for (auto& key : keys()) m_session->subscribe(key, this);
+    m_session->register_stream(m_ih, m_th);
+
+    // Пиры, отдававшие данные в прошлый раз (в том числе метаданные
+    // по magnet-ссылке)
+    for (auto const& ep : m_session->known_peers(m_ih))
+        m_th.connect_peer(ep);
+
+    m_save_path = atp.save_path;
+
+    if (atp.ti)
+        set_metadata();
+
+    // Проверка файлов могла завершиться раньше, чем мы подписались.
+    // Дальше ничего не ждём: первое чтение само дождётся конца проверки
+    // и тогда прочитает состояние кусков
+    if (!init_disk_state())
+        m_disk_stale.store(true);
 }
 
 Download::~Download()
 {
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
+    for (auto& key : keys()) m_session->unsubscribe(key, this);
+    m_session->unregister_stream(m_ih);
+    close_files();
+
+    if (m_th.is_valid()) {
+        // Запоминаем пиров, от которых хоть что-то получили: самые
+        // щедрые — первыми
+        std::vector<lt::peer_info> peers;
+        m_th.get_peer_info(peers);
+        std::sort(peers.begin(), peers.end(),
+                  [](const lt::peer_info& a, const lt::peer_info& b) {
+                      return a.total_download > b.total_download;
+                  });
+        std::vector<lt::tcp::endpoint> good;
+        for (auto const& p : peers) {
+            if (p.total_download > 0)
+                good.push_back(p.ip);
+        }
+        m_session->remember_peers(m_ih, good);
+    }
+
+    // Последний снимок fast-resume: при следующем открытии проверять
+    // файлы заново не придётся
+    if (m_th.is_valid() && !m_resume_path.empty()) {
+        SaveResumePromise resprom(m_ih);
+        AlertSubscriber<SaveResumePromise> sub(m_session, &resprom);
+        auto f = resprom.get_future();
+        m_th.save_resume_data(lt::torrent_handle::flush_disk_cache);
+        if (f.wait_for(std::chrono::seconds(5)) == std::future_status::ready) {
+            try { write_resume_data(f.get()); }
+            catch (const std::runtime_error&) {}
+        }
+    }
+
     if (m_th.is_valid()) {
-        RemovePromise rmprom(m_th.info_hash());
+        RemovePromise rmprom(m_ih);
         AlertSubscriber<RemovePromise> sub(m_session, &rmprom);
         auto f = rmprom.get_future();
         m_session->remove_torrent(m_th, m_keep);
@@ -237,50 +660,118 @@ ssize_t Download::read(int file, int64_t fileoff, char* buf, size_t buflen, Data
     D(printf("%s:%d: %s(%d, %lu, %p, %lu)\n", __FILE__, __LINE__, __func__,
              file, fileoff, buf, buflen));
 
+    // Повторять ожидание некому, кроме нас: на мёртвом рое — ошибка, а не
+    // вечное ожидание
+    auto deadline = std::chrono::steady_clock::now()
+                    + std::chrono::seconds(PIECE_READ_TIMEOUT);
+    PieceView view;
+    for (;;) {
+        view = acquire(file, fileoff, buflen, progress_cb);
+        if (!view.pending)
+            break;
+        if (std::chrono::steady_clock::now() >= deadline)
+            throw std::runtime_error("Timeout reading piece");
+    }
+    if (view.size == 0) return 0;
+
+    memcpy(buf, view.data, view.size);
+    return (ssize_t)view.size;
+}
+
+PieceView Download::acquire(int reader, int file, int64_t fileoff, size_t maxlen,
+                           DataProgressCb progress_cb)
+{
+    D(printf("%s:%d: %s(%d, %lu, %lu)\n", __FILE__, __LINE__, __func__,
+             file, fileoff, maxlen));
+
     download_metadata();
 
-    auto ti = m_th.torrent_file();
-    auto fs = ti->files();
+    auto ti = get_torrent_info();
+    const lt::file_storage& fs = ti->files();
     if (file < 0 || file >= fs.num_files())
         throw std::runtime_error("File not found");
     if (fileoff < 0)
         throw std::runtime_error("File offset negative");
     int64_t filesz = fs.file_size(file);
-    if (fileoff >= filesz) return 0;
+    if (fileoff >= filesz) return PieceView();
 
     auto part = ti->map_file(file, fileoff,
         (int)std::min({ (int64_t)std::numeric_limits<int>::max(),
-                        (int64_t)buflen, filesz - fileoff }));
-    if (part.length <= 0) return 0;
+                        (int64_t)maxlen, filesz - fileoff }));
+    if (part.length <= 0) return PieceView();
 
-    // Приоритеты
-    set_piece_priority(file, fileoff, part.length, PRIO_HIGHEST);
+    // Отдаём не дальше конца куска
+    part.length = std::min(part.length, ti->piece_size(part.piece) - part.start);
 
-    int64_t p01 = std::max(
-        std::min((int64_t)std::numeric_limits<int>::max(), filesz / 1000),
-        (int64_t)128 * kB);
-    set_piece_priority(file, 0, (int)p01, PRIO_HIGHER);
-    set_piece_priority(file, filesz - p01, (int)p01, PRIO_HIGHER);
+    // Приоритеты
+    update_window(*ti, reader, file, fileoff);
+    m_session->stream_active(m_ih, m_stream_rate.load(), window_missing(reader));
 
-    int64_t p5 = std::max(
-        std::min((int64_t)std::numeric_limits<int>::max(), 5 * filesz / 100),
-        (int64_t)32 * MB);
-    set_piece_priority(file, fileoff, (int)p5, PRIO_HIGH);
+    // Пока идёт проверка файлов, have_piece() ещё ничего не знает
+    // о кусках на диске
+    wait_checked();
 
-    if (!m_th.have_piece(part.piece)) {
-        DownloadPiecePromise dlprom(m_th.info_hash(), part.piece);
+    if (!m_have.have(static_cast<int>(part.piece))) {
+        DownloadPiecePromise dlprom(m_ih, part.piece);
         AlertSubscriber<DownloadPiecePromise> sub(m_session, &dlprom);
-        auto f = dlprom.get_future();
-        if (progress_cb) progress_cb(0.0);
-        auto status = f.wait_for(std::chrono::seconds(PIECE_READ_TIMEOUT));
-        if (status == std::future_status::timeout)
-            throw std::runtime_error("Timeout waiting for piece to download");
-        f.get();
-        if (progress_cb) progress_cb(100.0);
+        // Подписка уже есть: кусок, докачанный после этой проверки,
+        // разбудит ожидание
+        if (!confirm_piece(part.piece)) {
+            // Стоп и закрытие в VLC прерывают ожидание, как и в download()
+            vlc_interrupt_guard<DownloadPiecePromise> intrguard(dlprom);
+            auto f = dlprom.get_future();
+            StageTimer t(m_piece_wait);
+            if (progress_cb) progress_cb(0.0);
+            auto deadline = std::chrono::steady_clock::now()
+                            + std::chrono::milliseconds(PIECE_WAIT_SLICE_MS);
+            PieceView view = wait_piece(*ti, part, f, deadline, progress_cb);
+            if (view.size > 0) {
+                m_session->stream_buffering(m_ih, -1);
+                return view;
+            }
+            if (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                view.pending = true;
+                return view;
+            }
+            f.get();
+            // Подписчики куска получают алерт раньше handle_alert()
+            m_have.set(static_cast<int>(part.piece));
+            m_session->stream_buffering(m_ih, -1);
+            if (progress_cb) progress_cb(100.0);
+        }
     }
-    if (!m_th.have_piece(part.piece)) return 0;
 
-    return read(part, buf, buflen);
+    PieceView view;
+    int piece_size;
+    std::tie(view.buffer, piece_size) = read_piece(part.piece);
+
+    int len = std::min(piece_size - part.start, part.length);
+    if (len <= 0)
+        throw std::runtime_error("Short piece read");
+
+    view.data = view.buffer.get() + part.start;
+    view.size = (size_t)len;
+
+    if (fileoff == 0)
+        prefetch_index(*ti, file, view.data, view.size);
+
+    read_ahead(part.piece, ti->num_pieces(), ti->piece_length());
+    return view;
+}
+
+// Куски [first, last], покрывающие участок файла; пустой — first > last
+static std::pair<int, int>
+piece_span(const lt::torrent_info& ti, int file, int64_t off, int64_t len)
+{
+    int64_t filesz = ti.files().file_size(file);
+    off = std::max((int64_t)0, std::min(off, filesz));
+    len = std::min(len, filesz - off);
+    if (len <= 0)
+        return { 0, -1 };
+
+    int first = static_cast<int>(ti.map_file(file, off, 1).piece);
+    int last = static_cast<int>(ti.map_file(file, off + len - 1, 1).piece);
+    return { first, last };
 }
 
 void Download::set_piece_priority(int file, int64_t off, int size, libtorrent::download_priority_t prio)
@@ -288,18 +779,331 @@ void Download::set_piece_priority(int file, int64_t off, int size, libtorrent::d
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
     download_metadata();
 
-    auto ti = m_th.torrent_file();
-    auto fs = ti->files();
+    auto ti = get_torrent_info();
+    auto span = piece_span(*ti, file, off, size);
+
+    std::lock_guard<std::mutex> lg(m_sched_mtx);
+    init_priorities(*ti);
+
+    std::uint8_t p8 = static_cast<std::uint8_t>(prio);
+    for (int p = span.first; p <= span.second; p++)
+        m_prio_floor[(size_t)p] = std::max(m_prio_floor[(size_t)p], p8);
+
+    std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>> deltas;
+    collect_priorities(span.first, span.second, deltas);
+    if (!deltas.empty())
+        m_th.prioritize_pieces(deltas);
+}
+
+void Download::init_priorities(const lt::torrent_info& ti)
+{
+    if (!m_prio.empty())
+        return;
+
+    // Мы единственные, кто меняет приоритеты кусков, поэтому зеркало
+    // начинается с исходного приоритета libtorrent. В памяти качается
+    // только то, что нужно окнам, — остальное было бы тут же вытеснено
+    lt::download_priority_t base = m_storage_hint ? lt::dont_download : lt::default_priority;
+    m_prio.assign((size_t)ti.num_pieces(), static_cast<std::uint8_t>(base));
+    m_prio_floor = m_prio;
+}
+
+void Download::forget_dropped(const lt::torrent_info& ti)
+{
+    if (!m_storage_hint)
+        return;
+    std::vector<int> dropped;
+    {
+        std::lock_guard<std::mutex> lg(m_storage_hint->mtx);
+        dropped.swap(m_storage_hint->dropped);
+    }
+
+    // Нули не сходятся с хэшем: libtorrent снимает кусок со скачанных,
+    // а скачает снова с тем приоритетом, что нужен окнам сейчас
+    std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>> deltas;
+    std::vector<char> zeros;
+    for (int p : dropped) {
+        if (!m_have.have(p))
+            continue;
+        m_forgetting.set(p);
+        m_have.clear(p);
+        zeros.assign((size_t)ti.piece_size(lt::piece_index_t(p)), 0);
+        m_th.add_piece(lt::piece_index_t(p), zeros.data(),
+                       lt::torrent_handle::overwrite_existing);
+        collect_priorities(p, p, deltas);
+    }
+    if (!deltas.empty())
+        m_th.prioritize_pieces(deltas);
+}
+
+int Download::wanted_priority(int piece) const
+{
+    // Читателей единицы, перебор дешевле любого индекса окон
+    int prio = m_prio_floor[(size_t)piece];
+    for (auto const& r : m_readers) {
+        const Playhead& ph = r.second;
+        if (piece >= ph.head && piece <= ph.urgent)
+            prio = std::max(prio, PRIO_HIGHEST);
+        else if (piece >= ph.head && piece <= ph.last)
+            prio = std::max(prio, PRIO_HIGH);
+    }
+    return prio;
+}
+
+bool Download::deadline_shared(int reader, int piece) const
+{
+    for (auto const& r : m_readers) {
+        if (r.first != reader && r.second.deadlines.count(piece))
+            return true;
+    }
+    return false;
+}
+
+bool Download::window_missing(int reader)
+{
+    std::lock_guard<std::mutex> lg(m_sched_mtx);
+    auto it = m_readers.find(reader);
+    if (it == m_readers.end() || it->second.head < 0)
+        return false;
+    const Playhead& ph = it->second;
+    return m_have.next_missing(ph.head, ph.urgent) <= ph.urgent;
+}
+
+void Download::collect_priorities(int first, int last,
+                                  std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>>& deltas)
+{
+    first = std::max(first, 0);
+    last = std::min(last, (int)m_prio.size() - 1);
+
+    // Приоритет скачанного куска libtorrent уже ни на что не влияет
+    for (int p = m_have.next_missing(first, last); p <= last;
+         p = m_have.next_missing(p + 1, last)) {
+        int prio = wanted_priority(p);
+        if (prio == m_prio[(size_t)p])
+            continue;
+        m_prio[(size_t)p] = static_cast<std::uint8_t>(prio);
+        deltas.emplace_back(lt::piece_index_t(p),
+                            lt::download_priority_t(static_cast<std::uint8_t>(prio)));
+    }
+}
+
+void Download::drop_window(int reader)
+{
+    auto it = m_readers.find(reader);
+    if (it == m_readers.end() || it->second.head < 0)
+        return;
+    Playhead& ph = it->second;
+    StageTimer t(m_prio_cost);
+
+    for (int p : ph.deadlines) {
+        if (!deadline_shared(reader, p))
+            m_th.reset_piece_deadline(lt::piece_index_t(p));
+    }
+    ph.deadlines.clear();
+
+    int old_head = ph.head;
+    int old_last = ph.last;
+    ph.file = ph.head = ph.urgent = ph.last = -1;
+
+    std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>> deltas;
+    collect_priorities(old_head, old_last, deltas);
+    if (!deltas.empty())
+        m_th.prioritize_pieces(deltas);
+}
+
+void Download::prefetch_index(const lt::torrent_info& ti, int file,
+                              const char* head, size_t len)
+{
+    std::lock_guard<std::mutex> lg(m_sched_mtx);
+    if (!m_sniffed.insert(file).second)
+        return;
+
+    init_priorities(ti);
+
+    std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>> deltas;
+    queue_index(ti, file, head, len, true, deltas);
+    if (!deltas.empty())
+        m_th.prioritize_pieces(deltas);
+}
+
+void Download::queue_index(const lt::torrent_info& ti, int file,
+                           const char* head, size_t len, bool urgent,
+                           std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>>& deltas)
+{
+    auto ranges = container_index_ranges(head, len, ti.files().file_size(file));
+
+    // Весь индекс заказывается разом, со сроками подряд: демультиплексору
+    // не придётся ждать кусок за куском по мере разбора. В сроки окон
+    // эти куски не попадают — окна читателей их сроки не снимают
+    std::uint8_t prio = urgent ? PRIO_HIGHEST : PRIO_HIGH;
+    int n = 0;
+    for (auto const& r : ranges) {
+        auto span = piece_span(ti, file, r.off, r.len);
+        for (int p = span.first; p <= span.second; p++) {
+            m_prio_floor[(size_t)p] = std::max(m_prio_floor[(size_t)p], prio);
+            if (urgent)
+                m_th.set_piece_deadline(lt::piece_index_t(p),
+                                        INDEX_DEADLINE_MS + n++ * DEADLINE_STEP_MS);
+        }
+        collect_priorities(span.first, span.second, deltas);
+    }
+}
+
+// Следующий файл плейлиста (порядок MetadataReadDir — порядок файлов
+// торрента) начинаем качать, пока доигрывает текущий: начало, конец
+// и индекс контейнера. Приоритет — как у дальней части окна, ниже
+// срочной: текущему файлу прогрев не мешает
+void Download::warm_next_file(const lt::torrent_info& ti, int file, int64_t off,
+                              std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>>& deltas)
+{
+    const lt::file_storage& fs = ti.files();
     int64_t filesz = fs.file_size(file);
-    off = std::min(off, filesz);
-    size = (int)std::min({ (int64_t)std::numeric_limits<int>::max(),
-                           (int64_t)size, filesz - off });
+    int pct = m_next_file_pct.load();
+    if (pct <= 0 || off * 100 < filesz * pct)
+        return;
+
+    int next = file + 1;
+    while (next < fs.num_files() && (fs.pad_file_at(next) || fs.file_size(next) == 0))
+        next++;
+    if (next >= fs.num_files())
+        return;
+    int64_t nextsz = fs.file_size(next);
+
+    auto it = m_warmed.find(next);
+    if (it == m_warmed.end()) {
+        it = m_warmed.emplace(next, false).first;
+
+        int64_t rate = m_stream_rate.load();
+        int64_t head = std::max(rate * NEXT_FILE_HEAD_S, (int64_t)NEXT_FILE_HEAD_MIN);
+        int64_t p01 = std::max(nextsz / 1000, (int64_t)128 * kB);
+        for (auto span : { piece_span(ti, next, 0, head),
+                           piece_span(ti, next, nextsz - p01, p01) }) {
+            for (int p = span.first; p <= span.second; p++)
+                m_prio_floor[(size_t)p] = std::max(m_prio_floor[(size_t)p], (std::uint8_t)PRIO_HIGH);
+            collect_priorities(span.first, span.second, deltas);
+        }
+    }
+
+    // Индекс — когда начало файла уже скачано и проверено
+    if (it->second || m_sniffed.count(next))
+        return;
+    lt::peer_request first = ti.map_file(next, 0, 1);
+    if (!m_have.have(static_cast<int>(first.piece)))
+        return;
+    int len = (int)std::min({ (int64_t)(ti.piece_size(first.piece) - first.start),
+                              nextsz, (int64_t)NEXT_FILE_SNIFF });
+    std::vector<char> buf((size_t)len);
+    {
+        std::lock_guard<std::mutex> lg(m_disk_mtx);
+        if (!read_from_files(ti, first.piece, first.start, len, buf.data()))
+            return;
+    }
+    it->second = true;
+    queue_index(ti, next, buf.data(), buf.size(), false, deltas);
+}
+
+void Download::set_next_file_prefetch(int pct)
+{
+    m_next_file_pct = pct;
+}
+
+void Download::update_window(const lt::torrent_info& ti, int reader, int file, int64_t off)
+{
+    int64_t filesz = ti.files().file_size(file);
+    if (off < 0 || off >= filesz)
+        return;
+
+    int head = static_cast<int>(ti.map_file(file, off, 1).piece);
+
+    std::lock_guard<std::mutex> lg(m_sched_mtx);
+    init_priorities(ti);
+    forget_dropped(ti);
+
+    Playhead& ph = m_readers[reader];
+    if (file == ph.file && head == ph.head)
+        return;
+    StageTimer t(m_prio_cost);
+
+    std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>> deltas;
+
+    // Начало и конец файла (там обычно индексы контейнера) поднимаются
+    // один раз на файл и дальше окном не трогаются
+    if (m_edges_done.insert(file).second) {
+        int64_t p01 = std::max(filesz / 1000, (int64_t)128 * kB);
+        for (auto span : { piece_span(ti, file, 0, p01),
+                           piece_span(ti, file, filesz - p01, p01) }) {
+            for (int p = span.first; p <= span.second; p++)
+                m_prio_floor[(size_t)p] = std::max(m_prio_floor[(size_t)p], (std::uint8_t)PRIO_HIGHER);
+            collect_priorities(span.first, span.second, deltas);
+        }
+    }
+
+    int old_head = ph.head;
+    int old_urgent = ph.urgent;
+    int old_last = ph.last;
 
-    auto part = ti->map_file(file, off, size);
-    for (; part.length > 0; part.length -= ti->piece_size(part.piece++)) {
-        if (!m_th.have_piece(part.piece) &&
-            m_th.piece_priority(part.piece) < prio)
-            m_th.piece_priority(part.piece, prio);
+    int64_t rate = m_stream_rate.load();
+    int64_t piece_length = ti.piece_length();
+    int64_t window, urgent;
+    if (rate > 0) {
+        urgent = rate * m_caching_ms.load() / 1000;
+        window = rate * WINDOW_LOOKAHEAD_S;
+    } else {
+        urgent = WINDOW_URGENT;
+        window = std::max(5 * filesz / 100, (int64_t)WINDOW_MIN);
+    }
+    urgent = std::min(std::max(urgent, WINDOW_URGENT_PIECES * piece_length),
+                      WINDOW_URGENT_MAX_PIECES * piece_length);
+    window = std::max(window, urgent);
+
+    ph.file = file;
+    ph.head = head;
+    ph.urgent = piece_span(ti, file, off, urgent).second;
+    ph.last = piece_span(ti, file, off, window).second;
+    if (m_storage_hint)
+        m_storage_hint->head.store(head, std::memory_order_relaxed);
+
+    // Желаемый приоритет меняется только у кусков между старой и новой
+    // границей окна этого читателя (окна остальных не двигались); при
+    // прыжке за пределы старого окна — пересчитываем оба окна целиком
+    if (old_head < 0 || old_last < head || ph.last < old_head) {
+        collect_priorities(old_head, old_last, deltas);
+        collect_priorities(head, ph.last, deltas);
+    } else {
+        collect_priorities(std::min(old_head, head), std::max(old_head, head), deltas);
+        collect_priorities(std::min(old_urgent, ph.urgent),
+                           std::max(old_urgent, ph.urgent), deltas);
+        collect_priorities(std::min(old_last, ph.last),
+                           std::max(old_last, ph.last), deltas);
+    }
+
+    warm_next_file(ti, file, off, deltas);
+
+    if (!deltas.empty())
+        m_th.prioritize_pieces(deltas);
+
+    // Срочная часть окна уходит в time-critical очередь libtorrent.
+    // Срок куска — когда до него дойдёт воспроизведение при текущей
+    // скорости потока; сроки считаются от текущего момента, поэтому
+    // выставляются заново. Срок, нужный другому читателю, не снимается
+    for (auto it = ph.deadlines.begin(); it != ph.deadlines.end();) {
+        if (*it < head || *it > ph.urgent) {
+            if (!deadline_shared(reader, *it))
+                m_th.reset_piece_deadline(lt::piece_index_t(*it));
+            it = ph.deadlines.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    int64_t file_offset = ti.files().file_offset(file);
+    for (int p = m_have.next_missing(head, ph.urgent); p <= ph.urgent;
+         p = m_have.next_missing(p + 1, ph.urgent)) {
+        int64_t ahead = std::max((int64_t)0, p * piece_length - file_offset - off);
+        int64_t deadline = rate > 0 ? ahead * 1000 / rate
+                                    : (int64_t)(p - head) * DEADLINE_STEP_MS;
+        m_th.set_piece_deadline(lt::piece_index_t(p),
+            (int)std::min(deadline, (int64_t)std::numeric_limits<int>::max()));
+        ph.deadlines.insert(p);
     }
 }
 
@@ -309,7 +1113,8 @@ std::vector<std::pair<std::string, uint64_t>> Download::get_files()
     download_metadata();
 
     std::vector<std::pair<std::string, uint64_t>> files;
-    const lt::file_storage& fs = m_th.torrent_file()->files();
+    auto ti = get_torrent_info();
+    const lt::file_storage& fs = ti->files();
     for (int i = 0; i < fs.num_files(); i++)
         files.emplace_back(fs.file_path(i), fs.file_size(i));
     return files;
@@ -320,37 +1125,73 @@ Download::get_files(char* metadata, size_t metadatasz)
 {
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
 
-    lt::error_code ec;
-    lt::torrent_info ti(metadata, (int)metadatasz, ec);
-    if (ec) throw std::runtime_error("Failed to parse metadata");
+    auto ti = TorrentRegistry::parse(metadata, metadatasz);
 
     std::vector<std::pair<std::string, uint64_t>> files;
-    const lt::file_storage& fs = ti.files();
+    const lt::file_storage& fs = ti->files();
     for (int i = 0; i < fs.num_files(); i++)
         files.emplace_back(fs.file_path(i), fs.file_size(i));
     return files;
 }
 
-std::shared_ptr<std::vector<char>> Download::get_metadata(
-    std::string url, std::string save_path,
-    std::string cache_path, MetadataProgressCb cb)
+static const std::vector<std::string> public_trackers = {
+    "udp://tracker.openbittorrent.com:6969/announce",
+    "udp://tracker.opentrackr.org:1337/announce",
+    "udp://open.demonii.com:1337/announce",
+    "udp://tracker.coppersurfer.tk:6969/announce",
+    "udp://tracker.leechers-paradise.org:6969/announce",
+    "udp://exodus.desync.com:6969/announce",
+    "udp://tracker.torrent.eu.org:451/announce",
+    "udp://tracker.moeking.me:6969/announce",
+    "udp://valakas.rollo.dnsabr.com:2710/announce",
+    "udp://p4p.arenabg.com:1337/announce"
+};
+
+static void bencode_string(std::vector<char>& out, const std::string& str)
 {
-    D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
+    std::string len = std::to_string(str.size()) + ":";
+    out.insert(out.end(), len.begin(), len.end());
+    out.insert(out.end(), str.begin(), str.end());
+}
 
-    static const std::vector<std::string> public_trackers = {
-        "udp://tracker.openbittorrent.com:6969/announce",
-        "udp://tracker.opentrackr.org:1337/announce",
-        "udp://open.demonii.com:1337/announce",
-        "udp://tracker.coppersurfer.tk:6969/announce",
-        "udp://tracker.leechers-paradise.org:6969/announce",
-        "udp://exodus.desync.com:6969/announce",
-        "udp://tracker.torrent.eu.org:451/announce",
-        "udp://tracker.moeking.me:6969/announce",
-        "udp://valakas.rollo.dnsabr.com:2710/announce",
-        "udp://p4p.arenabg.com:1337/announce"
-    };
+// Файл .torrent из исходного словаря info, байт в байт, и списка
+// трекеров. Ключи словаря bencode обязаны идти по порядку:
+// "announce-list" < "info"
+static std::shared_ptr<std::vector<char>>
+torrent_file_bytes(const lt::torrent_info& ti, const std::vector<std::string>& extra)
+{
+    std::vector<std::string> trackers;
+    for (auto const& ae : ti.trackers())
+        trackers.push_back(ae.url);
+    for (auto const& url : extra) {
+        if (std::find(trackers.begin(), trackers.end(), url) == trackers.end())
+            trackers.push_back(url);
+    }
 
-    lt::add_torrent_params atp;
+    auto info = ti.info_section();
+    auto out = std::make_shared<std::vector<char>>();
+    out->reserve((size_t)info.size() + 64 * trackers.size() + 32);
+    out->push_back('d');
+    if (!trackers.empty()) {
+        bencode_string(*out, "announce-list");
+        out->push_back('l');
+        for (auto const& url : trackers) {
+            out->push_back('l');
+            bencode_string(*out, url);
+            out->push_back('e');
+        }
+        out->push_back('e');
+    }
+    bencode_string(*out, "info");
+    out->insert(out->end(), info.data(), info.data() + info.size());
+    out->push_back('e');
+    return out;
+}
+
+// Параметры торрента по magnet-ссылке; false — это не magnet-ссылка
+static bool parse_magnet(const std::string& url, const std::string& save_path,
+                         lt::add_torrent_params& atp)
+{
     atp.save_path = save_path;
 
     atp.flags &= ~lt::torrent_flags::auto_managed;
@@ -358,126 +1199,264 @@ std::shared_ptr<std::vector<char>> Download::get_metadata(
 
     lt::error_code ec;
     lt::parse_magnet_uri(url, atp, ec);
-    if (ec) {
-        lt::error_code ec2;
-#if LIBTORRENT_VERSION_NUM < 10200
-        atp.ti = boost::make_shared<lt::torrent_info>(url, boost::ref(ec2));
-#else
-        atp.ti = std::make_shared<lt::torrent_info>(url, std::ref(ec2));
-#endif
-        if (ec2) throw std::runtime_error("Failed to parse metadata from file or magnet");
-    } else {
-        if (atp.trackers.empty()) {
-            atp.trackers = public_trackers;
-        }
+    if (ec)
+        return false;
 
-        std::string info_hash_str;
-#if LIBTORRENT_VERSION_NUM >= 20000
-        info_hash_str = lt::aux::to_hex(atp.info_hashes.v1.to_string());
-#else
-        info_hash_str = lt::aux::to_hex(atp.info_hash.to_string());
-#endif
-        std::string path = cache_path + DIR_SEP + info_hash_str + ".torrent";
+    if (atp.trackers.empty())
+        atp.trackers = public_trackers;
+    return true;
+}
 
-        lt::error_code ec_cache;
-#if LIBTORRENT_VERSION_NUM < 10200
-        atp.ti = boost::make_shared<lt::torrent_info>(path, boost::ref(ec_cache));
-#else
-        atp.ti = std::make_shared<lt::torrent_info>(path, std::ref(ec_cache));
-#endif
-        if (ec_cache) {
-            atp.ti.reset();
-            auto metadata = Download::get_download(atp, true)->get_metadata(cb);
+std::shared_ptr<std::vector<char>> Download::store_metadata(Download& dl,
+    const std::vector<std::string>& trackers, const std::string& cache_path,
+    const std::string& ih)
+{
+    // Трекеры ссылки сохраняются вместе с метаданными, чтобы повторное
+    // открытие из кэша ничем не отличалось от первого
+    auto ti = std::make_shared<lt::torrent_info>(*dl.get_torrent_info());
+    for (auto const& tracker : trackers)
+        ti->add_tracker(tracker);
+
+    auto metadata = torrent_file_bytes(*ti, {});
+
+    // Эти же байты VLC вернёт в MetadataOpen и DataOpen — там они найдутся
+    // в реестре без разбора
+    TorrentRegistry::add(metadata->data(), metadata->size(), ti);
+    MetadataCache::get(cache_path)->put(ih, metadata, ti);
+    return metadata;
+}
 
-            std::ofstream os(path, std::ios::binary | std::ios::trunc);
-            os.write(metadata->data(), (std::streamsize)metadata->size());
-            os.close();
+std::shared_ptr<std::vector<char>> Download::get_metadata(
+    std::string url, std::string save_path,
+    std::string cache_path, MetadataProgressCb cb)
+{
+    D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
+
+    lt::add_torrent_params atp;
+    if (parse_magnet(url, save_path, atp)) {
+        std::string info_hash_str = lt::aux::to_hex(atp_infohash(atp).to_string());
+
+        // Готовые метаданные отдаются как есть, без разбора и пересборки
+        std::shared_ptr<const std::vector<char>> cached;
+        std::shared_ptr<const lt::torrent_info> cached_ti;
+        if (MetadataCache::get(cache_path)->find(info_hash_str, cached, cached_ti))
+            return std::make_shared<std::vector<char>>(*cached);
+
+        auto dl = Download::get_metadata_download(atp);
+        dl->download_metadata(cb);
+        return store_metadata(*dl, atp.trackers, cache_path, info_hash_str);
+    }
 
-            return metadata;
+    // Локальный .torrent: отдаём его байты как есть
+    std::ifstream is(url, std::ios::binary);
+    auto metadata = std::make_shared<std::vector<char>>(
+        (std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    if (metadata->empty())
+        throw std::runtime_error("Failed to parse metadata from file or magnet");
+    TorrentRegistry::parse(metadata->data(), metadata->size());
+    return metadata;
+}
+
+// Очередь фоновой загрузки метаданных. Рабочие потоки ждут метаданные
+// короткими отрезками, чтобы выгрузка плагина не ждала мёртвых ссылок
+class MetadataPrefetcher {
+public:
+    static MetadataPrefetcher& get() { static MetadataPrefetcher inst; return inst; }
+
+    void add(const std::string& url, const std::string& save_path,
+             const std::string& cache_path) {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        if (!m_seen.insert(url).second) return;
+        m_queue.push_back(Job { url, save_path, cache_path });
+        m_cv.notify_one();
+    }
+
+private:
+    struct Job { std::string url, save_path, cache_path; };
+
+    MetadataPrefetcher() {
+        // Пул отложенного удаления должен пережить рабочие потоки
+        DownloadReaper::get();
+        for (int i = 0; i < PREFETCH_THREADS; i++)
+            m_threads.emplace_back(&MetadataPrefetcher::run, this);
+    }
+    ~MetadataPrefetcher() {
+        { std::lock_guard<std::mutex> lg(m_mtx); m_quit = true; }
+        m_cv.notify_all();
+        for (auto& t : m_threads) t.join();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lk(m_mtx);
+        while (!m_quit) {
+            if (m_queue.empty()) { m_cv.wait(lk); continue; }
+            Job job = std::move(m_queue.front());
+            m_queue.pop_front();
+            lk.unlock();
+            bool stored = false;
+            try { stored = fetch(job); } catch (const std::exception&) {}
+            lk.lock();
+            // Не дождались или не смогли — следующее открытие списка
+            // попробует снова
+            if (!stored)
+                m_seen.erase(job.url);
         }
     }
 
-    if (atp.ti && !atp.trackers.empty()) {
-        for (auto const& tracker : atp.trackers) {
-            atp.ti->add_tracker(tracker);
+    // true — метаданные в кэше
+    bool fetch(const Job& job) {
+        lt::add_torrent_params atp;
+        if (!parse_magnet(job.url, job.save_path, atp)) return false;
+
+        std::string ih = lt::aux::to_hex(atp_infohash(atp).to_string());
+        if (MetadataCache::get(job.cache_path)->contains(ih)) return true;
+
+        auto dl = Download::get_metadata_download(atp);
+        auto until = std::chrono::steady_clock::now()
+                     + std::chrono::seconds(PREFETCH_TIMEOUT);
+        while (!m_quit && std::chrono::steady_clock::now() < until) {
+            if (dl->wait_metadata(std::chrono::seconds(1))) {
+                Download::store_metadata(*dl, atp.trackers, job.cache_path, ih);
+                return true;
+            }
         }
+        return false;
     }
 
-    auto entry = lt::create_torrent(*atp.ti).generate();
-    auto metadata = std::make_shared<std::vector<char>>();
-    lt::bencode(std::back_inserter(*metadata), entry);
-    return metadata;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::atomic<bool> m_quit{false};
+    std::deque<Job> m_queue;
+    std::set<std::string> m_seen;
+    std::vector<std::thread> m_threads;
+};
+
+void Download::prefetch_metadata(const std::vector<std::string>& urls,
+    std::string save_path, std::string cache_path)
+{
+    for (auto const& url : urls)
+        MetadataPrefetcher::get().add(url, save_path, cache_path);
 }
 
-std::shared_ptr<Download> Download::get_download(lt::add_torrent_params& atp, bool k)
+std::shared_ptr<Download> Download::get_download(lt::add_torrent_params& atp, bool k,
+                                                 std::string resume_path, StorageHint hint,
+                                                 bool metadata_only)
 {
     D(printf("%s:%d: %s (from atp)\n", __FILE__, __LINE__, __func__));
 
-    lt::sha1_hash ih;
-    if (atp.ti) {
-#if LIBTORRENT_VERSION_NUM >= 20000
-        ih = atp.ti->info_hashes().v1;
-#else
-        ih = atp.ti->info_hash();
-#endif
-    } else {
-#if LIBTORRENT_VERSION_NUM >= 20000
-        ih = atp.info_hashes.v1;
-#else
-        ih = atp.info_hash;
-#endif
-    }
-
-    static std::mutex mtx;
-    std::unique_lock<std::mutex> lock(mtx);
-
-    static std::map<lt::sha1_hash, std::weak_ptr<Download>> dls;
-    static std::map<lt::sha1_hash, std::mutex> dls_mtx;
-    std::shared_ptr<Download> dl = dls[ih].lock();
-    if (!dl)
-        dls[ih] = dl = std::make_shared<Download>(dls_mtx[ih], atp, k);
-    return dl;
+    return DownloadTable::get().open(atp_infohash(atp), metadata_only, [&] {
+        return new Download(atp, k, resume_path, hint);
+    });
 }
 
-std::shared_ptr<Download> Download::get_download(char* md, size_t mdsz, std::string sp, bool k)
+std::shared_ptr<Download> Download::get_download(char* md, size_t mdsz, std::string sp,
+                                                 std::string cp, bool k,
+                                                 const StorageOptions& storage)
 {
     D(printf("%s:%d: %s (from buf)\n", __FILE__, __LINE__, __func__));
 
-    lt::add_torrent_params atp;
-    atp.save_path = sp;
+    auto shared = TorrentRegistry::parse(md, mdsz);
 
-    atp.flags &= ~lt::torrent_flags::auto_managed;
-    atp.flags &= ~lt::torrent_flags::paused;
-    atp.flags &= ~lt::torrent_flags::duplicate_is_error;
-
-    lt::error_code ec;
-#if LIBTORRENT_VERSION_NUM < 10200
-    atp.ti = boost::make_shared<lt::torrent_info>(md, (int)mdsz, boost::ref(ec));
+#if LIBTORRENT_VERSION_NUM >= 20000
+    lt::sha1_hash ih = shared->info_hashes().v1;
 #else
-    atp.ti = std::make_shared<lt::torrent_info>(md, (int)mdsz, std::ref(ec));
+    lt::sha1_hash ih = shared->info_hash();
 #endif
-    if (ec) throw std::runtime_error("Failed to parse metadata");
-    return Download::get_download(atp, k);
+
+    // Всё дальнейшее нужно, только если торрент не открыт и не отложен:
+    // иначе объект общий, а копия и fast-resume ушли бы в мусор
+    return DownloadTable::get().open(ih, false, [&]() -> Download* {
+        // libtorrent получает свою копию torrent_info — копирование
+        // дешевле разбора и не даёт торренту менять общий объект
+        auto ti = std::make_shared<lt::torrent_info>(*shared);
+
+        std::string resume_path;
+        if (!cp.empty())
+            resume_path = cp + DIR_SEP + lt::aux::to_hex(ih.to_string()) + ".resume";
+
+        // Fast-resume имеет смысл, только если файлы переживают закрытие
+        lt::add_torrent_params atp;
+        if (k && !resume_path.empty()) {
+            std::ifstream is(resume_path, std::ios::binary);
+            std::vector<char> buf((std::istreambuf_iterator<char>(is)),
+                                  std::istreambuf_iterator<char>());
+            if (!buf.empty()) {
+                lt::error_code rec;
+                lt::add_torrent_params rp = lt::read_resume_data(
+                    { buf.data(), static_cast<std::ptrdiff_t>(buf.size()) }, rec);
+                // Данные от другого торрента (или битые) — игнорируем
+                if (!rec && atp_infohash(rp) == ih)
+                    atp = std::move(rp);
+                // Приоритеты прошлого сеанса — окна прошлых читателей.
+                // Зеркало приоритетов (init_priorities) начинается с исходных
+                atp.piece_priorities.clear();
+                atp.file_priorities.clear();
+            }
+        } else if (!resume_path.empty()) {
+            vlc_unlink(resume_path.c_str());
+            resume_path.clear();
+        }
+
+        atp.ti = ti;
+        atp.save_path = sp;
+
+        atp.flags &= ~lt::torrent_flags::auto_managed;
+        atp.flags &= ~lt::torrent_flags::paused;
+        atp.flags &= ~lt::torrent_flags::duplicate_is_error;
+
+        // Файлы, которые всё равно удалятся при закрытии, можно не писать.
+        // Кускам вне окон — нулевой приоритет с самого начала, как в
+        // зеркале приоритетов (init_priorities)
+        StorageHint hint;
+        if (storage.mode == StorageMode::memory && !k) {
+            hint = std::make_shared<MemoryStorageState>();
+            if (use_memory_storage(atp, storage.memory_limit, hint))
+                atp.piece_priorities.assign((size_t)ti->num_pieces(), lt::dont_download);
+            else
+                hint.reset();
+        }
+
+        return new Download(atp, k, resume_path, hint);
+    });
 }
 
 std::pair<int, uint64_t> Download::get_file(std::string path)
 {
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
     download_metadata();
+    build_file_index();
 
-    const lt::file_storage& fs = m_th.torrent_file()->files();
-    for (int i = 0; i < fs.num_files(); i++) {
-        if (fs.file_path(i) == path)
-            return std::make_pair(i, (uint64_t)fs.file_size(i));
-    }
-    throw std::runtime_error("Failed to find file");
+    auto it = m_file_index.find(path);
+    if (it == m_file_index.end())
+        throw std::runtime_error("Failed to find file");
+    return it->second;
+}
+
+void Download::build_file_index()
+{
+    if (m_file_index_ready.load(std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::mutex> lg(m_file_index_mtx);
+    if (m_file_index_ready.load(std::memory_order_relaxed))
+        return;
+
+    auto ti = get_torrent_info();
+    const lt::file_storage& fs = ti->files();
+    m_file_index.reserve((size_t)fs.num_files());
+    for (int i = 0; i < fs.num_files(); i++)
+        m_file_index.emplace(fs.file_path(i),
+            std::make_pair(i, (uint64_t)fs.file_size(i)));
+
+    // После публикации индекс только читается, без блокировок
+    m_file_index_ready.store(true, std::memory_order_release);
 }
 
 std::string Download::get_name()
 {
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
     download_metadata();
-    return m_th.torrent_file()->name();
+    return get_torrent_info()->name();
 }
 
 std::string Download::get_infohash()
@@ -497,54 +1476,88 @@ lt::torrent_handle Download::get_handle()
     return m_th;
 }
 
-/* --- НОВОЕ: отдаём реальный статус для оверлея --- */
-bool Download::query_status(BtOverlayStatus &out)
-{
-    if (!m_th.is_valid())
-        return false;
-
-#if LIBTORRENT_VERSION_NUM >= 10100
-    auto flags = lt::torrent_handle::query_name
-               | lt::torrent_handle::query_accurate_download_counters;
-    lt::torrent_status st = m_th.status(flags);
-#else
-    lt::torrent_status st = m_th.status();
-#endif
-
-    out.progress_pct   = st.progress * 100.0;
-    out.download_kib_s = (long long)(st.download_payload_rate / 1024);
-    out.upload_kib_s   = (long long)(st.upload_payload_rate   / 1024);
-    out.peers          = st.num_peers;
-    return true;
-}
-/* --- КОНЕЦ НОВОГО --- */
-
 std::shared_ptr<std::vector<char>> Download::get_metadata(MetadataProgressCb cb)
 {
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
     download_metadata(cb);
 
-    auto entry = lt::create_torrent(*m_th.torrent_file()).generate();
-    auto buffer = std::make_shared<std::vector<char>>();
-    lt::bencode(std::back_inserter(*buffer), entry);
-    return buffer;
+    return torrent_file_bytes(*get_torrent_info(), {});
 }
 
 void Download::download_metadata(MetadataProgressCb cb)
 {
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
 
-    if (m_th.status().has_metadata)
+    if (m_has_metadata.load(std::memory_order_acquire))
         return;
 
-    MetadataDownloadPromise dlprom(m_th.info_hash());
+    // Подписываемся до проверки статуса, чтобы не пропустить алерт
+    MetadataDownloadPromise dlprom(m_ih);
     AlertSubscriber<MetadataDownloadPromise> sub(m_session, &dlprom);
     vlc_interrupt_guard<MetadataDownloadPromise> intrguard(dlprom);
 
-    auto f = dlprom.get_future();
-    if (cb) cb(0.0);
-    f.get();
-    if (cb) cb(100.0);
+    if (!m_th.status().has_metadata) {
+        auto f = dlprom.get_future();
+        if (cb) cb(0.0);
+        f.get();
+        if (cb) cb(100.0);
+    }
+
+    set_metadata();
+}
+
+bool Download::wait_metadata(std::chrono::milliseconds timeout)
+{
+    if (m_has_metadata.load(std::memory_order_acquire))
+        return true;
+
+    MetadataDownloadPromise dlprom(m_ih);
+    AlertSubscriber<MetadataDownloadPromise> sub(m_session, &dlprom);
+
+    if (!m_th.status().has_metadata) {
+        auto f = dlprom.get_future();
+        if (f.wait_for(timeout) != std::future_status::ready)
+            return false;
+        f.get();
+    }
+
+    set_metadata();
+    return true;
+}
+
+void Download::wait_checked()
+{
+    if (!m_checked.load(std::memory_order_acquire)) {
+        // Подписываемся до проверки статуса, чтобы не пропустить алерт
+        CheckedPromise prom(m_ih);
+        AlertSubscriber<CheckedPromise> sub(m_session, &prom);
+        vlc_interrupt_guard<CheckedPromise> intrguard(prom);
+
+        lt::torrent_status st = m_th.status();
+        if (st.state == lt::torrent_status::checking_files
+            || st.state == lt::torrent_status::checking_resume_data)
+            prom.get_future().get();
+
+        m_checked.store(true, std::memory_order_release);
+    }
+
+    if (m_disk_stale.exchange(false) && !init_disk_state())
+        m_disk_stale.store(true);
+}
+
+void Download::set_metadata()
+{
+    auto ti = m_th.torrent_file();
+    if (!ti) return;
+    m_have.init(ti->num_pieces());
+    m_forgetting.init(ti->num_pieces());
+    std::atomic_store(&m_ti, ti);
+    m_has_metadata.store(true, std::memory_order_release);
+}
+
+std::shared_ptr<const lt::torrent_info> Download::get_torrent_info() const
+{
+    return std::atomic_load(&m_ti);
 }
 
 void Download::download(lt::peer_request part, DataProgressCb cb)
@@ -552,42 +1565,461 @@ void Download::download(lt::peer_request part, DataProgressCb cb)
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
     download_metadata();
 
-    if (m_th.have_piece(part.piece))
+    if (m_have.have(static_cast<int>(part.piece)))
         return;
 
-    DownloadPiecePromise dlprom(m_th.info_hash(), part.piece);
+    DownloadPiecePromise dlprom(m_ih, part.piece);
     AlertSubscriber<DownloadPiecePromise> sub(m_session, &dlprom);
+    if (confirm_piece(part.piece))
+        return;
     vlc_interrupt_guard<DownloadPiecePromise> intrguard(dlprom);
 
     auto f = dlprom.get_future();
+    StageTimer t(m_piece_wait);
     if (cb) cb(0.0);
     f.get();
+    m_have.set(static_cast<int>(part.piece));
     if (cb) cb(100.0);
 }
 
-ssize_t Download::read(lt::peer_request part, char* buf, size_t buflen)
+bool Download::confirm_piece(lt::piece_index_t piece)
+{
+    if (m_have.have(static_cast<int>(piece)))
+        return true;
+    if (m_forgetting.have(static_cast<int>(piece)) || !m_th.have_piece(piece))
+        return false;
+    m_have.set(static_cast<int>(piece));
+    return true;
+}
+
+std::pair<boost::shared_array<char>, int> Download::read_piece(lt::piece_index_t piece)
 {
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
-    download_metadata();
 
-    ReadPiecePromise rdprom(m_th.info_hash(), part.piece);
+    boost::shared_array<char> piece_buffer;
+    int piece_size;
+    if (m_cache.get(static_cast<int>(piece), piece_buffer, piece_size))
+        return std::make_pair(piece_buffer, piece_size);
+
+    // Кусок уже лежит в файлах на диске — читаем его напрямую, минуя
+    // дисковый поток libtorrent и очередь алертов
+    if (read_piece_from_disk(piece, piece_buffer, piece_size)) {
+        m_disk_reads.fetch_add(1, std::memory_order_relaxed);
+        m_cache.put(static_cast<int>(piece), piece_buffer, piece_size);
+        return std::make_pair(piece_buffer, piece_size);
+    }
+
+    ReadPiecePromise rdprom(m_ih, piece);
     AlertSubscriber<ReadPiecePromise> sub(m_session, &rdprom);
     vlc_interrupt_guard<ReadPiecePromise> intrguard(rdprom);
 
     auto f = rdprom.get_future();
-    m_th.read_piece(part.piece);
 
-    boost::shared_array<char> piece_buffer;
-    int piece_size;
+    // Кусок мог попасть в кэш упреждающим чтением, пока мы подписывались.
+    // Если же он ещё в пути, достаточно дождаться уже заказанного алерта.
+    if (m_cache.peek(static_cast<int>(piece), piece_buffer, piece_size))
+        return std::make_pair(piece_buffer, piece_size);
+    auto issued = std::chrono::steady_clock::time_point::min();
+    {
+        std::lock_guard<std::mutex> lg(m_inflight_mtx);
+        if (!m_inflight.count(static_cast<int>(piece))) {
+            m_read_piece_calls.fetch_add(1, std::memory_order_relaxed);
+            issued = std::chrono::steady_clock::now();
+            m_th.read_piece(piece);
+        }
+    }
+
     std::tie(piece_buffer, piece_size) = f.get();
+    // Заказанные упреждающим чтением учитываются в handle_alert()
+    if (issued != std::chrono::steady_clock::time_point::min())
+        m_read_piece_lat.record(std::chrono::steady_clock::now() - issued);
+    m_cache.put(static_cast<int>(piece), piece_buffer, piece_size);
+    return std::make_pair(piece_buffer, piece_size);
+}
+
+bool Download::request_piece(lt::piece_index_t piece)
+{
+    if (m_cache.contains(static_cast<int>(piece)))
+        return false;
+
+    std::lock_guard<std::mutex> lg(m_inflight_mtx);
+    if (!m_inflight.emplace(static_cast<int>(piece),
+                            std::chrono::steady_clock::now()).second)
+        return false;
+    m_read_piece_calls.fetch_add(1, std::memory_order_relaxed);
+    m_th.read_piece(piece);
+    return true;
+}
+
+DownloadCounters Download::counters() const
+{
+    DownloadCounters c;
+    c.read_piece_calls = m_read_piece_calls.load(std::memory_order_relaxed);
+    c.disk_reads = m_disk_reads.load(std::memory_order_relaxed);
+    c.cache_hits = m_cache.hits();
+    c.cache_misses = m_cache.misses();
+    return c;
+}
+
+std::string Download::stats_text() const
+{
+    DownloadCounters c = counters();
+    uint64_t lookups = c.cache_hits + c.cache_misses;
+    char buf[192];
+    snprintf(buf, sizeof(buf),
+             "piece_cache hits=%llu misses=%llu hit_rate=%.1f%% read_piece=%llu disk_reads=%llu\n",
+             (unsigned long long)c.cache_hits, (unsigned long long)c.cache_misses,
+             lookups ? 100.0 * (double)c.cache_hits / (double)lookups : 0.0,
+             (unsigned long long)c.read_piece_calls, (unsigned long long)c.disk_reads);
+
+    return m_piece_wait.format("piece_wait", true) + "\n"
+           + m_read_piece_lat.format("read_piece", true) + "\n"
+           + m_prio_cost.format("prioritize", true) + "\n"
+           + buf + m_session->stats_text();
+}
+
+void Download::read_ahead(lt::piece_index_t piece, int num_pieces, int piece_length)
+{
+    int64_t bytes = m_ra_bytes.load();
+    int count = READ_AHEAD_MIN;
+    if (bytes > 0 && piece_length > 0)
+        count = (int)std::min<int64_t>(READ_AHEAD_MAX,
+            (bytes + piece_length - 1) / piece_length);
+
+    // Не заказываем больше, чем поместится в кэш рядом с текущим куском
+    if (piece_length > 0)
+        count = std::min(count,
+            (int)(m_cache.capacity() / (size_t)piece_length) - 1);
+    count = std::max(count, 0);
+
+    int head = static_cast<int>(piece);
+    m_ra_count = count;
+    if (m_ra_head.exchange(head) == head)
+        return;
 
-    int len = std::min({ (int)(piece_size - part.start),
-                         (int)buflen,
-                         part.length });
-    if (len < 0) return -1;
+    for (int p = head + 1; p <= head + count && p < num_pieces; p++) {
+        if (m_have.have(p))
+            request_piece(lt::piece_index_t(p));
+    }
+}
 
-    memcpy(buf, piece_buffer.get() + part.start, (size_t)len);
-    return (ssize_t)len;
+void Download::set_stream_rate(int64_t bytes_per_sec, int64_t caching_ms)
+{
+    if (bytes_per_sec <= 0 || caching_ms <= 0)
+        return;
+    m_ra_bytes = bytes_per_sec * caching_ms / 1000;
+    m_stream_rate = bytes_per_sec;
+    m_caching_ms = caching_ms;
+}
+
+void Download::set_foreground(bool fg)
+{
+    m_session->set_stream_class(m_ih, fg ? StreamClass::foreground
+                                         : StreamClass::background);
+}
+
+void Download::write_resume_data(const lt::add_torrent_params& params)
+{
+    if (m_resume_path.empty())
+        return;
+
+    // Через временный файл: оборванная запись не испортит прежний снимок
+    std::vector<char> buf = lt::write_resume_data_buf(params);
+    std::string tmp = m_resume_path + ".tmp";
+    {
+        std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+        os.write(buf.data(), (std::streamsize)buf.size());
+        if (!os) {
+            os.close();
+            vlc_unlink(tmp.c_str());
+            return;
+        }
+    }
+#ifdef _WIN32
+    vlc_unlink(m_resume_path.c_str());
+#endif
+    if (vlc_rename(tmp.c_str(), m_resume_path.c_str()))
+        vlc_unlink(tmp.c_str());
+}
+
+void Download::save_resume_data()
+{
+    if (m_resume_path.empty() || !m_th.need_save_resume_data())
+        return;
+    m_resume_time = std::chrono::steady_clock::now();
+    m_th.save_resume_data(lt::torrent_handle::flush_disk_cache);
+}
+
+void Download::set_partial_pieces(bool enable)
+{
+    m_partial_pieces = enable;
+}
+
+void Download::set_playhead(int reader, int file, int64_t off)
+{
+    D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
+    download_metadata();
+
+    auto ti = get_torrent_info();
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lg(m_sched_mtx);
+        Playhead& ph = m_readers[reader];
+        // Первая перемотка серии применяется сразу, следующие за ней —
+        // нет: окно прошлой позиции только снимается, а новое
+        // выставит первое чтение на месте, где ползунок остановился
+        bool burst = now - ph.seek_time < std::chrono::milliseconds(SEEK_DEBOUNCE_MS);
+        ph.seek_time = now;
+        if (burst) {
+            drop_window(reader);
+            return;
+        }
+    }
+    update_window(*ti, reader, file, off);
+}
+
+int Download::add_reader()
+{
+    std::lock_guard<std::mutex> lg(m_sched_mtx);
+    int reader = m_next_reader++;
+    m_readers[reader];
+    return reader;
+}
+
+void Download::remove_reader(int reader)
+{
+    std::lock_guard<std::mutex> lg(m_sched_mtx);
+    drop_window(reader);
+    if (reader != DEFAULT_READER)
+        m_readers.erase(reader);
+}
+
+static bool read_file_at(int fd, char* buf, int64_t len, int64_t off)
+{
+    while (len > 0) {
+#ifdef _WIN32
+        if (_lseeki64(fd, off, SEEK_SET) != off) return false;
+        int n = _read(fd, buf, (unsigned)std::min<int64_t>(len, 1 << 30));
+#else
+        ssize_t n = pread(fd, buf, (size_t)len, (off_t)off);
+#endif
+        if (n <= 0) return false;
+        buf += n; off += n; len -= n;
+    }
+    return true;
+}
+
+bool Download::read_from_files(const lt::torrent_info& ti, lt::piece_index_t piece,
+    int start, int len, char* dst)
+{
+    // Куски только в хранилище libtorrent: читаются через read_piece
+    if (m_storage_hint)
+        return false;
+
+    const lt::file_storage& fs = ti.files();
+
+    int64_t pos = 0;
+    for (auto const& slice : fs.map_block(piece, start, len)) {
+        if (fs.pad_file_at(slice.file_index)) {
+            memset(dst + pos, 0, (size_t)slice.size);
+        } else {
+            int fi = static_cast<int>(slice.file_index);
+            auto it = m_fds.find(fi);
+            if (it == m_fds.end()) {
+                std::string path = fs.file_path(slice.file_index, m_save_path);
+                int fd = vlc_open(path.c_str(), O_RDONLY);
+                if (fd < 0) return false;
+                it = m_fds.emplace(fi, fd).first;
+            }
+            if (!read_file_at(it->second, dst + pos, slice.size, slice.offset))
+                return false;
+        }
+        pos += slice.size;
+    }
+    return pos == len;
+}
+
+bool Download::read_piece_from_disk(lt::piece_index_t piece,
+    boost::shared_array<char>& buffer, int& size)
+{
+    std::lock_guard<std::mutex> lg(m_disk_mtx);
+
+    int p = static_cast<int>(piece);
+    if (p < 0 || p >= (int)m_on_disk.size() || !m_on_disk[(size_t)p])
+        return false;
+
+    auto ti = get_torrent_info();
+    if (!ti) return false;
+
+    int piece_size = ti->piece_size(piece);
+    boost::shared_array<char> buf(new char[(size_t)piece_size]);
+    if (!read_from_files(*ti, piece, 0, piece_size, buf.get()))
+        return false;
+
+    buffer = buf;
+    size = piece_size;
+    return true;
+}
+
+std::pair<int, int> Download::written_bytes(const lt::torrent_info& ti,
+                                           lt::piece_index_t piece)
+{
+    std::vector<lt::partial_piece_info> queue;
+    m_th.get_download_queue(queue);
+
+    for (auto const& pp : queue) {
+        if (pp.piece_index != piece)
+            continue;
+        // finished — блок уже записан в файл, а не просто получен от пира
+        int prefix = 0;
+        while (prefix < pp.blocks_in_piece
+               && pp.blocks[prefix].state == lt::block_info::finished)
+            prefix++;
+        int total = pp.finished + pp.writing;
+        int size = ti.piece_size(piece);
+        return { std::min(prefix * BLOCK_SIZE, size), std::min(total * BLOCK_SIZE, size) };
+    }
+    return { 0, 0 };
+}
+
+PieceView Download::wait_piece(const lt::torrent_info& ti,
+    const lt::peer_request& part, std::future<void>& piece_done,
+    std::chrono::steady_clock::time_point deadline, DataProgressCb progress_cb)
+{
+    BlockProgress progress(m_ih, part.piece);
+    AlertSubscriber<BlockProgress> sub(m_session, &progress);
+    bool partial = m_partial_pieces.load();
+    int piece_size = ti.piece_size(part.piece);
+    int shown = -1;
+
+    while (std::chrono::steady_clock::now() < deadline) {
+        // Кусок проверен целиком (или ожидание прервано) — дальше решает
+        // вызывающий
+        if (piece_done.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            break;
+
+        auto written = written_bytes(ti, part.piece);
+        int pct = piece_size > 0 ? (int)((int64_t)written.second * 100 / piece_size) : 0;
+        if (pct != shown) {
+            shown = pct;
+            m_session->stream_buffering(m_ih, pct);
+            if (progress_cb) progress_cb((float)pct);
+        }
+
+        int len = partial ? std::min(written.first - part.start, part.length) : 0;
+        if (len > 0) {
+            // Непроверенные данные в кэш кусков не попадают
+            boost::shared_array<char> buf(new char[(size_t)len]);
+            std::lock_guard<std::mutex> lg(m_disk_mtx);
+            if (read_from_files(ti, part.piece, part.start, len, buf.get())) {
+                PieceView view;
+                view.buffer = buf;
+                view.data = buf.get();
+                view.size = (size_t)len;
+                return view;
+            }
+        }
+
+        // Блок, пришедший от пира, записывается асинхронно, поэтому
+        // после алерта очередь загрузки всё равно перепроверяется по таймеру
+        progress.wait_for(std::chrono::milliseconds(PARTIAL_POLL_MS));
+    }
+    return PieceView();
+}
+
+void Download::close_files()
+{
+    std::lock_guard<std::mutex> lg(m_disk_mtx);
+    for (auto& fd : m_fds) vlc_close(fd.second);
+    m_fds.clear();
+}
+
+bool Download::init_disk_state()
+{
+    lt::torrent_status st = m_th.status(lt::torrent_handle::query_pieces);
+    if (!st.has_metadata
+        || st.state == lt::torrent_status::checking_files
+        || st.state == lt::torrent_status::checking_resume_data)
+        return false;
+
+    m_checked.store(true, std::memory_order_release);
+
+    // Всё, что есть на момент окончания проверки, уже записано на диск
+    // (если куски вообще в файлах)
+    std::lock_guard<std::mutex> lg(m_disk_mtx);
+    m_have.init(st.pieces.size());
+    m_forgetting.init(st.pieces.size());
+    m_on_disk.assign((size_t)st.pieces.size(), false);
+    for (int i = 0; i < st.pieces.size(); i++) {
+        if (!st.pieces.get_bit(lt::piece_index_t(i)))
+            continue;
+        m_have.set(i);
+        m_on_disk[(size_t)i] = !m_storage_hint;
+    }
+    return true;
+}
+
+std::vector<AlertKey> Download::keys() const
+{
+    return { { lt::read_piece_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+             { lt::piece_finished_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+             { lt::hash_failed_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+             { lt::torrent_checked_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+             { lt::torrent_finished_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+             { lt::cache_flushed_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+             { lt::metadata_received_alert::alert_type, m_ih, AlertKey::ANY_PIECE },
+             { lt::save_resume_data_alert::alert_type, m_ih, AlertKey::ANY_PIECE } };
+}
+
+void Download::handle_alert(lt::alert* a)
+{
+    if (auto* x = lt::alert_cast<lt::read_piece_alert>(a)) {
+        int p = static_cast<int>(x->piece);
+        std::lock_guard<std::mutex> lg(m_inflight_mtx);
+        auto it = m_inflight.find(p);
+        if (it == m_inflight.end()) return;
+        m_read_piece_lat.record(std::chrono::steady_clock::now() - it->second);
+        // Сначала кладём в кэш, потом снимаем отметку «в пути»: читатель,
+        // не нашедший кусок в кэше, не должен решить, что ждать нечего
+        if (!x->error)
+            m_cache.put(p, x->buffer, x->size);
+        m_inflight.erase(it);
+    } else if (auto* x = lt::alert_cast<lt::piece_finished_alert>(a)) {
+        // Кусок докачался внутри окна упреждения — сразу тянем его в память
+        int p = static_cast<int>(x->piece_index);
+        m_forgetting.clear(p);
+        m_have.set(p);
+        int head = m_ra_head.load();
+        if (head >= 0 && p > head && p <= head + m_ra_count.load())
+            request_piece(x->piece_index);
+
+        if (std::chrono::steady_clock::now() - m_resume_time
+            >= std::chrono::seconds(RESUME_SAVE_INTERVAL))
+            save_resume_data();
+    } else if (auto* x = lt::alert_cast<lt::hash_failed_alert>(a)) {
+        m_forgetting.clear(static_cast<int>(x->piece_index));
+        m_have.clear(static_cast<int>(x->piece_index));
+    } else if (lt::alert_cast<lt::torrent_checked_alert>(a)) {
+        // Статус — синхронный вызов в поток сети: здесь он задержал бы
+        // разбор всех алертов пачки, поэтому его делает читатель
+        m_disk_stale.store(true);
+    } else if (lt::alert_cast<lt::torrent_finished_alert>(a)) {
+        // Свежескачанные куски могут быть ещё в дисковом кэше libtorrent:
+        // читать их из файлов напрямую можно только после сброса кэша
+        m_th.flush_cache();
+        save_resume_data();
+    } else if (auto* x = lt::alert_cast<lt::save_resume_data_alert>(a)) {
+        write_resume_data(x->params);
+    } else if (lt::alert_cast<lt::cache_flushed_alert>(a)) {
+        m_disk_stale.store(true);
+    } else if (lt::alert_cast<lt::metadata_received_alert>(a)) {
+        set_metadata();
+    }
+}
+
+void Download::set_piece_cache_size(size_t bytes)
+{
+    m_cache.set_capacity(bytes);
 }
 
 void Download::set_piece_priority(int file, int64_t off, int size, int priority)
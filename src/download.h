@@ -11,11 +11,19 @@
 #define VLC_BITTORRENT_DOWNLOAD_H
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <forward_list>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <thread>
+#include <unordered_map>
 #include <functional>
+#include <future>
+#include <map>
+#include <string>
+#include <vector>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-conversion"
@@ -24,34 +32,82 @@
 #include <libtorrent/peer_request.hpp>
 #include <libtorrent/session.hpp>
 #include <libtorrent/torrent_handle.hpp>
+#include <libtorrent/torrent_info.hpp>
 #pragma GCC diagnostic pop
 
+#include "memorystorage.h"
+#include "piecebitmap.h"
+#include "piececache.h"
 #include "session.h"
+#include "stats.h"
 
 namespace lt = libtorrent;
 
 using MetadataProgressCb = std::function<void(float)>;
 using DataProgressCb = std::function<void(float)>;
 
-/* Добавлено: компактный срез статуса для оверлея */
-struct BtOverlayStatus {
-    double     progress_pct;      // 0..100
-    long long  download_kib_s;    // КиБ/с
-    long long  upload_kib_s;      // КиБ/с
-    int        peers;             // активные пиры
+/* Счётчики пути чтения, для измерений */
+struct DownloadCounters {
+    uint64_t read_piece_calls;  // read_piece через libtorrent
+    uint64_t disk_reads;        // кусок прочитан из файлов напрямую
+    uint64_t cache_hits;
+    uint64_t cache_misses;
 };
 
-class Download {
+/* Участок куска из кэша без копирования: буфер куска жив, пока жив view */
+struct PieceView {
+    boost::shared_array<char> buffer;
+    const char* data = nullptr;
+    size_t      size = 0;
+    bool        pending = false;    // данных пока нет, спросить ещё раз
+};
+
+class Download : public Alert_Listener {
 
 public:
     Download(const Download&) = delete;
     Download& operator=(const Download&) = delete;
-    Download(std::mutex& mtx, lt::add_torrent_params& atp, bool k);
+    // hint — общее с хранилищем в памяти, если atp его подключает
+    // (см. memorystorage.h); без него куски пишутся в файлы
+    Download(lt::add_torrent_params& atp, bool k, std::string resume_path,
+             StorageHint hint);
     ~Download();
 
+    // cache_path — каталог для fast-resume данных (используются только
+    // вместе с keep: иначе файлы всё равно удаляются при закрытии).
+    // storage выбирает, где держать куски; StorageMode::memory действует
+    // только без keep. Открытия одного торрента получают общий объект;
+    // открытие другого торрента не ждёт, пока добавляется этот
     static std::shared_ptr<Download>
-    get_download(char* metadata, size_t metadatalen, std::string save_path, bool keep);
+    get_download(char* metadata, size_t metadatalen, std::string save_path,
+                 std::string cache_path, bool keep, const StorageOptions& storage);
+
+    static std::shared_ptr<Download>
+    get_download(char* metadata, size_t metadatalen, std::string save_path,
+                 std::string cache_path, bool keep)
+    {
+        return get_download(metadata, metadatalen, save_path, cache_path, keep,
+                            StorageOptions());
+    }
+
+    // Куски хранятся в памяти, а не в каталоге загрузок
+    bool in_memory() const
+    {
+        return m_storage_hint != nullptr;
+    }
+
+    // Читатели одного торрента (видео и звук из разных файлов, миниатюры
+    // рядом с воспроизведением) — каждый со своей позицией. Окна
+    // приоритетов всех читателей сливаются: кусок получает наибольший
+    // из приоритетов. Читатель DEFAULT_READER есть всегда, его используют
+    // перегрузки без номера читателя
+    static const int DEFAULT_READER = 0;
 
+    int add_reader();
+    void remove_reader(int reader);
+
+    // Копия в buf; ждёт кусок сам, но не дольше PIECE_READ_TIMEOUT, потом
+    // бросает std::runtime_error
     ssize_t
     read(int file, int64_t off, char* buf, size_t buflen, DataProgressCb progress_cb);
 
@@ -61,6 +117,27 @@ public:
         return read(file, off, buf, buflen, nullptr);
     }
 
+    // То же, что read(), но отдаёт ссылку на данные куска вместо копии.
+    // Данные отдаются не дальше конца куска — сколько есть подряд. Если
+    // куска нет, ожидание длится не дольше PIECE_WAIT_SLICE_MS и
+    // прерывается из VLC; не дождались — пустой view с pending (процент
+    // загрузки куска виден как буферизация). Пустой без pending — конец
+    // файла. read() повторяет ожидание сам, пока данные не придут
+    PieceView
+    acquire(int reader, int file, int64_t off, size_t maxlen, DataProgressCb progress_cb);
+
+    PieceView
+    acquire(int file, int64_t off, size_t maxlen, DataProgressCb progress_cb)
+    {
+        return acquire(DEFAULT_READER, file, off, maxlen, progress_cb);
+    }
+
+    PieceView
+    acquire(int file, int64_t off, size_t maxlen)
+    {
+        return acquire(DEFAULT_READER, file, off, maxlen, nullptr);
+    }
+
     static std::vector<std::pair<std::string, uint64_t>>
     get_files(char* metadata, size_t metadatalen);
 
@@ -77,6 +154,12 @@ public:
         return get_metadata(url, save_path, cache_path, nullptr);
     }
 
+    // Фоновая загрузка метаданных для magnet-ссылок (например, всего
+    // плейлиста), чтобы к моменту воспроизведения они были в кэше
+    static void
+    prefetch_metadata(const std::vector<std::string>& urls, std::string save_path,
+                      std::string cache_path);
+
     std::shared_ptr<std::vector<char>>
     get_metadata(MetadataProgressCb progress_cb);
 
@@ -98,17 +181,69 @@ public:
     lt::torrent_handle
     get_handle();
 
-    // --- НАЧАЛО ИЗМЕНЕНИЯ: публичный метод статуса для оверлея ---
-    bool query_status(BtOverlayStatus &out);
-    // --- КОНЕЦ ИЗМЕНЕНИЯ ---
-
     // --- НАЧАЛО ИЗМЕНЕНИЯ: удобная перегрузка для приоритета ---
     void set_piece_priority(int file, int64_t off, int size, int priority);
     // --- КОНЕЦ ИЗМЕНЕНИЯ ---
 
+    DownloadCounters counters() const;
+
+    // Гистограммы стадий чтения (ожидание куска из сети, read_piece,
+    // обновление приоритетов), кэш кусков и поток сессии — по строке
+    // на стадию, для журнала
+    std::string stats_text() const;
+
+    // Лимит памяти кэша прочитанных кусков, в байтах
+    void set_piece_cache_size(size_t bytes);
+
+    // Скорость потребления потока (байт/с) и network-caching (мс):
+    // из них выводится глубина упреждающего чтения кусков
+    void set_stream_rate(int64_t bytes_per_sec, int64_t caching_ms);
+
+    // Отдавать начало ещё не проверенного куска, как только его блоки
+    // записаны на диск (по умолчанию выключено: данные без проверки хэша)
+    void set_partial_pieces(bool enable);
+
+    // Перенести окно приоритетов и дедлайнов к новой позиции (перемотка),
+    // не дожидаясь следующего чтения. Перемотки чаще раза в
+    // SEEK_DEBOUNCE_MS (протаскивание ползунка) до libtorrent не доходят:
+    // окно к ним сдвинет первое чтение на новом месте
+    void set_playhead(int reader, int file, int64_t off);
+
+    void set_playhead(int file, int64_t off)
+    {
+        set_playhead(DEFAULT_READER, file, off);
+    }
+
+    // Когда воспроизведение прошло pct% файла, начать качать следующий
+    // файл торрента (следующий элемент плейлиста); 0 — не качать
+    void set_next_file_prefetch(int pct);
+
+    // Этот торрент сейчас смотрят: канал в первую очередь ему,
+    // см. Session::set_stream_class()
+    void set_foreground(bool fg);
+
 private:
+    friend class MetadataPrefetcher;
+
     static std::shared_ptr<Download>
-    get_download(lt::add_torrent_params& atp, bool k);
+    get_download(lt::add_torrent_params& atp, bool k, std::string resume_path,
+                 StorageHint hint, bool metadata_only);
+
+    // Только ради метаданных magnet-ссылки. Такой объект не откладывается
+    // в DownloadReaper, а удаляется сразу; открытие данных дожидается его
+    // и создаёт свой Download — со своими keep, fast-resume и хранилищем
+    static std::shared_ptr<Download>
+    get_metadata_download(lt::add_torrent_params& atp)
+    {
+        return get_download(atp, true, "", nullptr, true);
+    }
+
+    // Fast-resume: запись в m_resume_path через временный файл
+    void
+    write_resume_data(const lt::add_torrent_params& params);
+
+    void
+    save_resume_data();
 
     void
     download_metadata(MetadataProgressCb cb);
@@ -119,6 +254,31 @@ private:
         download_metadata(nullptr);
     }
 
+    // Дождаться метаданных не дольше timeout; false — не успели
+    bool
+    wait_metadata(std::chrono::milliseconds timeout);
+
+    // Метаданные из загрузки (с трекерами magnet-ссылки) — в кэш
+    static std::shared_ptr<std::vector<char>>
+    store_metadata(Download& dl, const std::vector<std::string>& trackers,
+                   const std::string& cache_path, const std::string& ih);
+
+    // Дождаться конца проверки файлов (прерываемо через VLC) и, если
+    // алерты о том просили, перечитать состояние кусков
+    void
+    wait_checked();
+
+    // Снимок torrent_info; публикуется один раз, когда метаданные готовы
+    void
+    set_metadata();
+
+    std::shared_ptr<const lt::torrent_info>
+    get_torrent_info() const;
+
+    // Индекс путь → (номер файла, размер); строится один раз по метаданным
+    void
+    build_file_index();
+
     void
     download(lt::peer_request part, DataProgressCb cb);
 
@@ -128,21 +288,226 @@ private:
         download(part, nullptr);
     }
 
-    ssize_t
-    read(lt::peer_request part, char* buf, size_t buflen);
+    // Кусок есть. Отрицательный ответ локального поля перепроверяется
+    // у libtorrent: алерт мог прийти раньше, чем поле было заведено.
+    // Зовётся, когда кусок иначе пришлось бы ждать
+    bool
+    confirm_piece(lt::piece_index_t piece);
+
+    // Буфер куска из кэша, либо через read_piece/read_piece_alert
+    std::pair<boost::shared_array<char>, int>
+    read_piece(lt::piece_index_t piece);
+
+    // Прямое чтение куска из файлов на диске, если он точно там
+    bool
+    read_piece_from_disk(lt::piece_index_t piece,
+                         boost::shared_array<char>& buffer, int& size);
+
+    // Чтение участка куска из файлов; вызывается с захваченным m_disk_mtx.
+    // С хранилищем в памяти файлов нет — всегда false
+    bool
+    read_from_files(const lt::torrent_info& ti, lt::piece_index_t piece,
+                    int start, int len, char* dst);
+
+    // Сколько байт куска записано на диск: first — подряд с начала,
+    // second — всего, включая блоки в очереди на запись
+    std::pair<int, int>
+    written_bytes(const lt::torrent_info& ti, lt::piece_index_t piece);
+
+    // Ожидание куска по блокам, до deadline или готовности куска; по
+    // пути сообщает процент буферизации. С partial pieces отдаёт начало
+    // куска, как только оно записано, иначе view всегда пустой
+    PieceView
+    wait_piece(const lt::torrent_info& ti, const lt::peer_request& part,
+               std::future<void>& piece_done,
+               std::chrono::steady_clock::time_point deadline,
+               DataProgressCb progress_cb);
+
+    // Состояние кусков по снимку статуса (синхронный вызов в поток сети,
+    // поэтому не из потока сессии). false — проверка ещё идёт
+    bool
+    init_disk_state();
+
+    void
+    close_files();
+
+    // Упреждающее чтение кусков, следующих за только что отданным
+    void
+    read_ahead(lt::piece_index_t piece, int num_pieces, int piece_length);
+
+    // Запросить кусок в кэш асинхронно; false, если он уже там или в пути
+    bool
+    request_piece(lt::piece_index_t piece);
+
+    // Алерты упреждающего чтения (поток сессии)
+    std::vector<AlertKey>
+    keys() const;
+
+    void
+    handle_alert(lt::alert* a) override;
 
     // Старая функция остаётся приватной
     void
     set_piece_priority(int file, int64_t off, int size, libtorrent::download_priority_t prio);
 
-    // Locks mutex passed to constructor
-    std::unique_lock<std::mutex> m_lock;
+    // Сдвинуть окно приоритетов читателя к позиции воспроизведения.
+    // libtorrent получает только изменившиеся приоритеты и только тогда,
+    // когда позиция перешла в другой кусок
+    void
+    update_window(const lt::torrent_info& ti, int reader, int file, int64_t off);
+
+    // Снять окно прошлой позиции читателя: дедлайны сбрасываются,
+    // приоритеты опускаются до того, что нужно остальным окнам и нижним
+    // пределам. Вызывается с захваченным m_sched_mtx
+    void
+    drop_window(int reader);
+
+    // Срок куска нужен другому читателю (с захваченным m_sched_mtx)
+    bool
+    deadline_shared(int reader, int piece) const;
+
+    // В срочной части окна читателя есть нескачанные куски
+    bool
+    window_missing(int reader);
+
+    // По первым байтам файла найти индекс контейнера и заказать его
+    // сразу, со сроками. Для каждого файла — один раз
+    void
+    prefetch_index(const lt::torrent_info& ti, int file, const char* head, size_t len);
+
+    // Вызываются с захваченным m_sched_mtx. urgent — со сроками и высшим
+    // приоритетом, иначе как дальняя часть окна
+    void
+    queue_index(const lt::torrent_info& ti, int file, const char* head, size_t len,
+                bool urgent,
+                std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>>& deltas);
+
+    void
+    warm_next_file(const lt::torrent_info& ti, int file, int64_t off,
+                   std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>>& deltas);
+
+    // Дальше — вызовы с захваченным m_sched_mtx
+    void
+    init_priorities(const lt::torrent_info& ti);
+
+    int
+    wanted_priority(int piece) const;
+
+    void
+    collect_priorities(int first, int last,
+                       std::vector<std::pair<lt::piece_index_t, lt::download_priority_t>>& deltas);
+
+    // Куски, выброшенные хранилищем в памяти, перестают быть скачанными,
+    // см. memorystorage.h
+    void
+    forget_dropped(const lt::torrent_info& ti);
+
+    // Пока объект жив (в том числе отложен в DownloadReaper), другой
+    // Download того же торрента не создаётся. Объявлен первым: отпускается
+    // последним, когда торрент уже удалён из сессии
+    struct Lease {
+        explicit Lease(const lt::sha1_hash& ih);
+        ~Lease();
+        lt::sha1_hash ih;
+    };
+    Lease m_lease;
 
     bool m_keep;
 
     std::shared_ptr<Session> m_session;
 
     lt::torrent_handle m_th;
+
+    lt::sha1_hash m_ih;
+
+    // Метаданные готовы: проверка без обращения к потоку libtorrent
+    std::atomic<bool> m_has_metadata{false};
+    std::shared_ptr<const lt::torrent_info> m_ti;
+
+    // Проверка файлов завершена, have_piece() отражает содержимое диска
+    std::atomic<bool> m_checked{false};
+
+    // torrent_checked_alert или cache_flushed_alert: состояние кусков
+    // перечитает следующее чтение
+    std::atomic<bool> m_disk_stale{false};
+
+    // Какие куски есть, без обращений к потоку libtorrent. Заполняется
+    // по окончании проверки, дальше — по алертам
+    PieceBitmap m_have;
+
+    // Выброшены хранилищем в памяти и перезаписаны, но libtorrent ещё
+    // не провалил их проверку: have_piece() для них пока врёт
+    PieceBitmap m_forgetting;
+
+    PieceCache m_cache;
+
+    // Файл fast-resume; пустой — не сохраняем
+    std::string m_resume_path;
+    std::chrono::steady_clock::time_point m_resume_time;
+
+    // Куски, для которых read_piece уже отправлен, а алерт ещё не пришёл,
+    // и когда отправлен
+    std::map<int, std::chrono::steady_clock::time_point> m_inflight;
+    std::mutex m_inflight_mtx;
+
+    std::atomic<uint64_t> m_read_piece_calls{0};
+    std::atomic<uint64_t> m_disk_reads{0};
+
+    Histogram m_piece_wait;         // кусок ещё не скачан: ожидание сети
+    Histogram m_read_piece_lat;     // read_piece → read_piece_alert
+    Histogram m_prio_cost;          // пересчёт окна приоритетов и сроков
+
+    // Окно упреждающего чтения: последний отданный кусок и глубина
+    std::atomic<int> m_ra_head{-1};
+    std::atomic<int> m_ra_count{0};
+    std::atomic<int64_t> m_ra_bytes{0};
+
+    std::atomic<bool> m_partial_pieces{false};
+
+    // Скорость потока (байт/с) от data.cpp; 0 — ещё не измерена
+    std::atomic<int64_t> m_stream_rate{0};
+    std::atomic<int64_t> m_caching_ms{0};
+
+    // Куски, которые гарантированно записаны в файлы (по окончании
+    // проверки или после сброса дискового кэша), и открытые файлы
+    std::string m_save_path;
+    std::vector<bool> m_on_disk;
+    std::map<int, int> m_fds;
+    std::mutex m_disk_mtx;
+
+    // Хранилище в памяти: сюда пишется кусок у позиции воспроизведения
+    // (последнего сдвинутого окна), оттуда приходят выброшенные куски;
+    // null — куски в файлах
+    StorageHint m_storage_hint;
+
+    // Окно одного читателя: [head, last], из него куски до urgent стоят
+    // в time-critical очереди (deadlines); время последней перемотки
+    struct Playhead {
+        int file = -1;
+        int head = -1;
+        int urgent = -1;
+        int last = -1;
+        std::set<int> deadlines;
+        std::chrono::steady_clock::time_point seek_time;
+    };
+
+    // Планировщик приоритетов: что уже отдано libtorrent, нижняя граница
+    // приоритета каждого куска (начало/конец файла, явные запросы) и
+    // окна читателей
+    std::mutex m_sched_mtx;
+    std::vector<std::uint8_t> m_prio;
+    std::vector<std::uint8_t> m_prio_floor;
+    std::set<int> m_edges_done;
+    std::set<int> m_sniffed;        // файлы, чей индекс уже заказан
+    // Прогретые следующие файлы; true — их индекс тоже заказан
+    std::map<int, bool> m_warmed;
+    std::atomic<int> m_next_file_pct{0};
+    std::map<int, Playhead> m_readers;
+    int m_next_reader = DEFAULT_READER + 1;
+
+    std::unordered_map<std::string, std::pair<int, uint64_t>> m_file_index;
+    std::atomic<bool> m_file_index_ready{false};
+    std::mutex m_file_index_mtx;
 };
 
 #endif
@@ -93,11 +93,6 @@ MagnetMetadataControl(stream_t* access, int query, va_list args)
 int
 MagnetMetadataOpen(vlc_object_t* p_this)
 {
-    // Инициализация общей переменной на libVLC через поле obj.libvlc
-    libvlc_int_t *libvlc = p_this->obj.libvlc;
-    var_Create(VLC_OBJECT(libvlc), "bt_overlay_text", VLC_VAR_STRING);
-    var_SetString(VLC_OBJECT(libvlc), "bt_overlay_text", "[BT] Fetching metadata...");
-
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
 
     stream_t* p_access = (stream_t*) p_this;
@@ -131,11 +126,6 @@ MagnetMetadataOpen(vlc_object_t* p_this)
         std::unique_ptr<vlc_dialog_id, decltype(del)> dialog(nullptr, del);
 
         auto prog = [&](float progress) {
-            // Публикуем прогресс метаданных в bt_overlay_text
-            char buf[128];
-            snprintf(buf, sizeof(buf), "[BT] Metadata: %.0f%%", progress * 100.0f);
-            var_SetString(VLC_OBJECT(libvlc), "bt_overlay_text", buf);
-
             if (!dialog)
                 dialog.reset(vlc_dialog_display_progress(p_this, true, progress,
                     NULL, "Downloading metadata",
@@ -144,6 +134,11 @@ MagnetMetadataOpen(vlc_object_t* p_this)
                 vlc_dialog_update_progress_text(p_this, dialog.get(), progress,
                     "Downloading metadata from peers...");
         };
+        Session::set_state_directory(get_cache_directory(p_this));
+        Session::get()->set_profile(get_profile(p_this));
+        if (get_prefetch_metadata(p_this))
+            Download::prefetch_metadata(get_playlist_magnets(p_this),
+                get_download_directory(p_this), get_cache_directory(p_this));
         p_sys->p_metadata = Download::get_metadata(magnet,
             get_download_directory(p_this), get_cache_directory(p_this), prog);
 
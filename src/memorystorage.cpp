@@ -0,0 +1,226 @@
+/*
+ * src/memorystorage.cpp
+ *
+ * Потоки диска libtorrent зовут хранилище одного торрента параллельно
+ * (разные куски), поэтому всё состояние — под одним мьютексом. Блоки
+ * по 16 КиБ копируются быстрее, чем длится любое ожидание на нём.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "memorystorage.h"
+
+#if LIBTORRENT_VERSION_NUM < 20000
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <libtorrent/storage.hpp>
+#include <libtorrent/storage_defs.hpp>
+#pragma GCC diagnostic pop
+
+#define D(x)
+
+namespace {
+
+class MemoryStorage final : public lt::storage_interface {
+public:
+    MemoryStorage(lt::file_storage const& fs, size_t limit, StorageHint hint)
+        : lt::storage_interface(fs)
+        , m_limit(limit), m_hint(std::move(hint))
+    {}
+
+    void
+    initialize(lt::storage_error&) override
+    {}
+
+    int
+    readv(lt::span<lt::iovec_t const> bufs, lt::piece_index_t piece, int offset,
+          lt::open_mode_t, lt::storage_error& ec) override
+    {
+        std::lock_guard<std::mutex> lg(m_mtx);
+
+        int p = static_cast<int>(piece);
+
+        // Выброшен, а libtorrent ещё считает его скачанным. Нехватку
+        // памяти libtorrent не считает поломкой хранилища: запрос
+        // отклоняется, торрент работает дальше
+        if (m_dropped.count(p)) {
+            ec.ec = lt::error_code(ENOMEM, lt::system_category());
+            ec.operation = lt::operation_t::file_read;
+            return -1;
+        }
+
+        auto it = m_pieces.find(p);
+        int n = 0;
+        for (auto const& b : bufs) {
+            int len = (int)b.size();
+            if (it != m_pieces.end()) {
+                copy_out(it->second, offset + n, b.data(), len);
+            } else {
+                // Ещё не записано: как дыра в разреженном файле
+                memset(b.data(), 0, (size_t)len);
+            }
+            n += len;
+        }
+        return n;
+    }
+
+    int
+    writev(lt::span<lt::iovec_t const> bufs, lt::piece_index_t piece, int offset,
+           lt::open_mode_t, lt::storage_error&) override
+    {
+        std::lock_guard<std::mutex> lg(m_mtx);
+
+        int p = static_cast<int>(piece);
+        int n = 0;
+
+        // Перезапись выброшенного куска (нулями от Download или заново
+        // скачанным) ничего не вытесняет: иначе каждая перезапись
+        // выбрасывала бы следующий кусок
+        bool rewrite = m_dropped.erase(p) > 0;
+
+        auto it = m_pieces.find(p);
+        if (it == m_pieces.end()) {
+            it = m_pieces.emplace(p, std::vector<char>((size_t)files().piece_size(piece))).first;
+            m_used += it->second.size();
+            if (!rewrite)
+                evict(p);
+        }
+        for (auto const& b : bufs) {
+            copy_in(it->second, offset + n, b.data(), (int)b.size());
+            n += (int)b.size();
+        }
+        return n;
+    }
+
+    // Ничего не сохраняется между открытиями: проверять нечего
+    bool
+    has_any_file(lt::storage_error&) override
+    {
+        return false;
+    }
+
+    void
+    set_file_priority(lt::aux::vector<lt::download_priority_t, lt::file_index_t>&,
+                      lt::storage_error&) override
+    {}
+
+    lt::status_t
+    move_storage(std::string const&, lt::move_flags_t, lt::storage_error&) override
+    {
+        return lt::status_t::no_error;
+    }
+
+    bool
+    verify_resume_data(lt::add_torrent_params const&,
+                       lt::aux::vector<std::string, lt::file_index_t> const&,
+                       lt::storage_error&) override
+    {
+        return false;
+    }
+
+    void
+    release_files(lt::storage_error&) override
+    {}
+
+    void
+    rename_file(lt::file_index_t, std::string const&, lt::storage_error&) override
+    {}
+
+    void
+    delete_files(lt::remove_flags_t, lt::storage_error&) override
+    {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        m_pieces.clear();
+        m_dropped.clear();
+        m_used = 0;
+    }
+
+private:
+    static void
+    copy_out(const std::vector<char>& piece, int off, char* dst, int len)
+    {
+        size_t avail = (size_t)off < piece.size()
+                       ? std::min((size_t)len, piece.size() - (size_t)off) : 0;
+        if (avail) memcpy(dst, piece.data() + off, avail);
+        memset(dst + avail, 0, (size_t)len - avail);
+    }
+
+    static void
+    copy_in(std::vector<char>& piece, int off, const char* src, int len)
+    {
+        size_t avail = (size_t)off < piece.size()
+                       ? std::min((size_t)len, piece.size() - (size_t)off) : 0;
+        if (avail) memcpy(piece.data() + off, src, avail);
+    }
+
+    // Пока памяти больше предела, куски кроме keep выбрасываются:
+    // сначала самый старый позади позиции воспроизведения, если позади
+    // ничего нет — самый дальний впереди
+    void
+    evict(int keep)
+    {
+        std::vector<int> dropped;
+        while (m_used > m_limit && m_pieces.size() > 1) {
+            int head = m_hint->head.load(std::memory_order_relaxed);
+
+            auto victim = m_pieces.begin();
+            if (victim->first == keep) ++victim;
+            if (head >= 0 && victim->first >= head) {
+                victim = std::prev(m_pieces.end());
+                if (victim->first == keep) --victim;
+            }
+
+            D(printf("%s:%d: drop piece %d\n", __FILE__, __LINE__, victim->first));
+            m_used -= victim->second.size();
+            m_dropped.insert(victim->first);
+            dropped.push_back(victim->first);
+            m_pieces.erase(victim);
+        }
+        if (dropped.empty()) return;
+
+        std::lock_guard<std::mutex> lg(m_hint->mtx);
+        m_hint->dropped.insert(m_hint->dropped.end(), dropped.begin(), dropped.end());
+    }
+
+    std::mutex m_mtx;
+    size_t m_limit;
+    size_t m_used = 0;
+    StorageHint m_hint;
+    std::map<int, std::vector<char>> m_pieces;
+    std::set<int> m_dropped;
+};
+
+} // namespace
+
+bool
+use_memory_storage(lt::add_torrent_params& atp, size_t limit, StorageHint hint)
+{
+    atp.storage = [limit, hint](lt::storage_params const& params, lt::file_pool&)
+        -> lt::storage_interface* {
+        return new MemoryStorage(params.files, limit, hint);
+    };
+    return true;
+}
+
+#else
+
+bool
+use_memory_storage(lt::add_torrent_params&, size_t, StorageHint)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * src/memorystorage.h
+ *
+ * Хранилище торрента в памяти для воспроизведения без сохранения
+ * файлов (bittorrent-keep-files выключен): куски не пишутся в каталог
+ * загрузок, чтобы потом быть удалёнными, — на SD-карте приставки эта
+ * запись и есть узкое место и износ. В памяти держится не больше
+ * memory_limit байт; сверх предела вытесняются куски, дальние от позиции
+ * воспроизведения: сначала самые старые позади неё, потом самые дальние
+ * впереди. Диск не трогается вовсе.
+ *
+ * Вытесненный кусок выбрасывается. Сам libtorrent 1.2 «забыть» кусок не
+ * умеет, поэтому хранилище только сообщает о нём Download, а тот
+ * перезаписывает кусок нулями (add_piece с overwrite_existing): проверка
+ * хэша проваливается, и libtorrent снимает кусок со скачанных и больше
+ * его не раздаёт. Скачан он будет снова, только если до него опять дойдёт
+ * окно воспроизведения. До перезаписи чтение выброшенного куска
+ * отклоняется.
+ *
+ * Своё хранилище торрента есть только в libtorrent 1.2 (storage_interface);
+ * в 2.0 хранилище общее на всю сессию, и там остаётся обычная запись на
+ * диск.
+ */
+
+#ifndef VLC_BITTORRENT_MEMORYSTORAGE_H
+#define VLC_BITTORRENT_MEMORYSTORAGE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <libtorrent/add_torrent_params.hpp>
+#include <libtorrent/version.hpp>
+#pragma GCC diagnostic pop
+
+namespace lt = libtorrent;
+
+enum class StorageMode { disk, memory };
+
+struct StorageOptions {
+    StorageMode mode = StorageMode::disk;
+    size_t memory_limit = 0;    // байт, для StorageMode::memory
+};
+
+// Общее у хранилища и Download
+struct MemoryStorageState {
+    // Кусок у позиции воспроизведения (-1 — неизвестно): по нему хранилище
+    // выбирает, что вытеснить. Пишет Download, читают потоки диска
+    std::atomic<int> head{-1};
+
+    // Выброшенные куски, которые Download ещё не перезаписал
+    std::mutex mtx;
+    std::vector<int> dropped;
+};
+
+using StorageHint = std::shared_ptr<MemoryStorageState>;
+
+// Подключить к atp хранилище в памяти. false — эта версия libtorrent
+// своего хранилища не поддерживает, atp не тронут
+bool
+use_memory_storage(lt::add_torrent_params& atp, size_t limit, StorageHint hint);
+
+#endif
@@ -35,16 +35,14 @@ MetadataReadDir(stream_directory_t* p_directory, input_item_node_t* p_node)
 {
     D(printf("%s:%d: %s()\n", __FILE__, __LINE__, __func__));
 
-    // Temporary buffer to hold metadata
-    auto md = std::make_unique<char[]>(0x100000);
-
-    ssize_t mdsz = vlc_stream_Read(p_directory->source, md.get(), 0x100000);
-    if (mdsz < 0)
+    // Read the whole .torrent; large torrents have metadata well over 1 MiB
+    std::vector<char> md;
+    if (!read_stream(p_directory->source, md, METADATA_MAX_SIZE))
         return VLC_EGENERIC;
 
     std::vector<std::pair<std::string, uint64_t>> files;
     try {
-        files = Download::get_files(md.get(), (size_t) mdsz);
+        files = Download::get_files(md.data(), md.size());
     } catch (std::runtime_error& e) {
         msg_Err(p_directory, "Failed to parse metadata: %s", e.what());
         return VLC_EGENERIC;
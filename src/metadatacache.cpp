@@ -0,0 +1,199 @@
+/*
+ * src/metadatacache.cpp
+ *
+ * Реализация кэша метаданных. Операции идут под одним мьютексом: файлы
+ * метаданных маленькие, а обращения к кэшу редки (открытие потока или
+ * предзагрузка), так что чтение файла под блокировкой не мешает.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "metadatacache.h"
+#include "torrentregistry.h"
+#include "vlc.h"
+
+// Суммарный размер файлов метаданных в каталоге кэша
+#define METADATA_CACHE_MAX (64 * 1024 * 1024)
+
+#define METADATA_SUFFIX ".torrent"
+// 40 hex-символов infohash + суффикс
+#define METADATA_NAME_LEN (40 + sizeof(METADATA_SUFFIX) - 1)
+
+std::shared_ptr<MetadataCache> MetadataCache::get(const std::string& dir)
+{
+    static std::mutex mtx;
+    static std::map<std::string, std::shared_ptr<MetadataCache>> caches;
+
+    std::lock_guard<std::mutex> lg(mtx);
+    auto& c = caches[dir];
+    if (!c)
+        c = std::make_shared<MetadataCache>(dir);
+    return c;
+}
+
+MetadataCache::MetadataCache(std::string dir)
+    : m_dir(std::move(dir))
+    , m_capacity(METADATA_CACHE_MAX)
+{
+}
+
+std::string MetadataCache::path_of(const std::string& ih) const
+{
+    return m_dir + DIR_SEP + ih + METADATA_SUFFIX;
+}
+
+void MetadataCache::load_index()
+{
+    if (m_loaded)
+        return;
+    m_loaded = true;
+
+    DIR* dir = vlc_opendir(m_dir.c_str());
+    if (!dir)
+        return;
+
+    const char* name;
+    while ((name = vlc_readdir(dir)) != NULL) {
+        std::string n(name);
+        if (n.size() != METADATA_NAME_LEN
+            || n.compare(40, std::string::npos, METADATA_SUFFIX) != 0)
+            continue;
+
+        struct stat st;
+        if (vlc_stat((m_dir + DIR_SEP + n).c_str(), &st))
+            continue;
+
+        Entry e;
+        e.size = (uint64_t)st.st_size;
+        e.used = (int64_t)st.st_mtime;
+        m_size += e.size;
+        m_index.emplace(n.substr(0, 40), std::move(e));
+    }
+    closedir(dir);
+
+    evict("");
+}
+
+bool MetadataCache::contains(const std::string& ih)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    load_index();
+    return m_index.count(ih) > 0;
+}
+
+bool MetadataCache::find(const std::string& ih,
+    std::shared_ptr<const std::vector<char>>& data,
+    std::shared_ptr<const lt::torrent_info>& ti)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    load_index();
+
+    auto it = m_index.find(ih);
+    if (it == m_index.end())
+        return false;
+
+    Entry& e = it->second;
+    if (!e.ti) {
+        std::ifstream is(path_of(ih), std::ios::binary);
+        auto buf = std::make_shared<std::vector<char>>(
+            (std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+
+        std::shared_ptr<const lt::torrent_info> parsed;
+        try {
+            if (!buf->empty())
+                parsed = TorrentRegistry::parse(buf->data(), buf->size());
+        } catch (const std::runtime_error&) {
+        }
+        if (!parsed) {
+            // Битый файл: больше на него не натыкаемся
+            remove(it);
+            return false;
+        }
+        e.data = buf;
+        e.ti = parsed;
+    }
+
+    e.used = (int64_t)time(NULL);
+    data = e.data;
+    ti = e.ti;
+    return true;
+}
+
+void MetadataCache::put(const std::string& ih,
+    std::shared_ptr<const std::vector<char>> data,
+    std::shared_ptr<const lt::torrent_info> ti)
+{
+    if (!data || data->empty())
+        return;
+
+    std::lock_guard<std::mutex> lg(m_mtx);
+    load_index();
+
+    // Через временный файл: параллельное открытие той же ссылки не
+    // прочитает недописанные метаданные
+    std::string path = path_of(ih);
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+        os.write(data->data(), (std::streamsize)data->size());
+        if (!os) {
+            os.close();
+            vlc_unlink(tmp.c_str());
+            return;
+        }
+    }
+#ifdef _WIN32
+    vlc_unlink(path.c_str());
+#endif
+    if (vlc_rename(tmp.c_str(), path.c_str())) {
+        vlc_unlink(tmp.c_str());
+        return;
+    }
+
+    Entry& e = m_index[ih];
+    m_size -= e.size;
+    e.size = data->size();
+    e.used = (int64_t)time(NULL);
+    e.data = std::move(data);
+    e.ti = std::move(ti);
+    m_size += e.size;
+
+    evict(ih);
+}
+
+void MetadataCache::set_capacity(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    m_capacity = bytes;
+    evict("");
+}
+
+void MetadataCache::remove(std::map<std::string, Entry>::iterator it)
+{
+    vlc_unlink(path_of(it->first).c_str());
+    m_size -= it->second.size;
+    m_index.erase(it);
+}
+
+void MetadataCache::evict(const std::string& keep)
+{
+    while (m_size > m_capacity && m_index.size() > 1) {
+        auto victim = m_index.end();
+        for (auto it = m_index.begin(); it != m_index.end(); ++it) {
+            if (it->first == keep)
+                continue;
+            if (victim == m_index.end() || it->second.used < victim->second.used)
+                victim = it;
+        }
+        if (victim == m_index.end())
+            break;
+        remove(victim);
+    }
+}
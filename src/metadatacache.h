@@ -0,0 +1,83 @@
+/*
+ * src/metadatacache.h
+ *
+ * Кэш метаданных (.torrent) в каталоге кэша VLC. Индекс каталога
+ * читается один раз, файл разбирается в torrent_info не больше одного
+ * раза за процесс, запись идёт через временный файл с переименованием,
+ * а суммарный размер ограничен: вытесняются давно не использованные.
+ */
+
+#ifndef VLC_BITTORRENT_METADATACACHE_H
+#define VLC_BITTORRENT_METADATACACHE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <libtorrent/torrent_info.hpp>
+#pragma GCC diagnostic pop
+
+namespace lt = libtorrent;
+
+class MetadataCache {
+public:
+    // Один экземпляр на каталог
+    static std::shared_ptr<MetadataCache> get(const std::string& dir);
+
+    explicit MetadataCache(std::string dir);
+
+    MetadataCache(const MetadataCache&) = delete;
+    MetadataCache& operator=(const MetadataCache&) = delete;
+
+    // Метаданные по infohash (hex). torrent_info общий и неизменяемый:
+    // для add_torrent_params нужна его копия, а не повторный разбор
+    bool
+    find(const std::string& ih, std::shared_ptr<const std::vector<char>>& data,
+         std::shared_ptr<const lt::torrent_info>& ti);
+
+    bool
+    contains(const std::string& ih);
+
+    void
+    put(const std::string& ih, std::shared_ptr<const std::vector<char>> data,
+        std::shared_ptr<const lt::torrent_info> ti);
+
+    void
+    set_capacity(uint64_t bytes);
+
+private:
+    struct Entry {
+        uint64_t size = 0;
+        int64_t  used = 0;   // для вытеснения: mtime файла или время обращения
+        std::shared_ptr<const std::vector<char>> data;
+        std::shared_ptr<const lt::torrent_info> ti;
+    };
+
+    std::string
+    path_of(const std::string& ih) const;
+
+    // Дальше — вызовы с захваченным m_mtx
+    void
+    load_index();
+
+    void
+    evict(const std::string& keep);
+
+    void
+    remove(std::map<std::string, Entry>::iterator it);
+
+    std::mutex m_mtx;
+    std::string m_dir;
+    bool m_loaded = false;
+    std::map<std::string, Entry> m_index;
+    uint64_t m_size = 0;
+    uint64_t m_capacity;
+};
+
+#endif
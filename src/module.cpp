@@ -25,6 +25,22 @@
 #include "magnetmetadata.h"   // access
 #include "overlay.h"          // overlay (Logger)
 
+// Профили настроек libtorrent, см. Session::set_profile()
+static const char* const ppsz_profiles[] = {
+    "default", "seek", "lan", "embedded"
+};
+static const char* const ppsz_profile_names[] = {
+    "Default", "Low-latency seek", "High-throughput LAN", "Low-memory embedded"
+};
+
+// Где держать куски, см. memorystorage.h
+static const char* const ppsz_storage[] = {
+    "disk", "memory"
+};
+static const char* const ppsz_storage_names[] = {
+    "Download directory", "Memory, drop far pieces past the limit"
+};
+
 // ────────────────────────────────────────────────────────────
 //                    Описание VLC-модуля
 // ────────────────────────────────────────────────────────────
@@ -42,6 +58,36 @@ vlc_module_begin()
                   "Directory where VLC will put downloaded files.", false)
     add_bool(KEEP_CONFIG, false, "Don't delete files",
              "Don't delete files after download.", true)
+    add_integer(CACHE_CONFIG, 64, "Piece cache size (MiB)",
+                "Memory used to keep recently read pieces.", true)
+    add_bool(PARTIAL_CONFIG, false, "Play partial pieces",
+             "Hand data to the player as soon as its blocks are written, "
+             "before the whole piece is hash-checked. Starts and seeks faster "
+             "on slow swarms, but corrupt data may reach the player.", true)
+    add_bool(PREFETCH_CONFIG, true, "Prefetch playlist metadata",
+             "When a magnet link is opened, fetch metadata for the other "
+             "magnet links in the playlist in the background.", true)
+    add_string(PROFILE_CONFIG, "default", "Settings profile",
+               "Disk cache, I/O threads and peer limits tuned as a set: "
+               "low-latency seek for fast start and seeking, high-throughput "
+               "LAN for fast nearby peers, low-memory embedded for set-top "
+               "boxes.", true)
+        change_string_list(ppsz_profiles, ppsz_profile_names)
+    add_integer_with_range(NEXTFILE_CONFIG, 80, 0, 100,
+                "Prefetch next file at (%)",
+                "When this much of a file has played, start fetching the "
+                "beginning and index of the next file in the torrent, so the "
+                "next playlist item starts without a gap. 0 disables.", true)
+    add_string(STORAGE_CONFIG, "disk", "Piece storage",
+               "Where pieces of files that are not kept are stored. Memory "
+               "storage never writes to the download directory and only "
+               "downloads what playback needs. Over the memory limit, pieces "
+               "far from the playback position are dropped, no longer "
+               "shared, and downloaded again if playback returns to them. "
+               "Ignored when files are kept. Needs libtorrent 1.2.", true)
+        change_string_list(ppsz_storage, ppsz_storage_names)
+    add_integer(MEMLIMIT_CONFIG, 256, "Memory storage limit (MiB)",
+                "Memory used for pieces with memory storage.", true)
 
     /* ──────────────── под-модуль: stream_extractor ─────────────── */
     add_submodule()
@@ -1,7 +1,8 @@
 /*****************************************************************************
  * overlay.cpp — BitTorrent status overlay (SUB SOURCE) для VLC 3.0.x
  * Совместимо с VLC 3.0.18 (ABI 3_0_0f). Компилируется как C++.
- * Источник текста берём из переменной libVLC: "bt_overlay_text".
+ * Статус берём с доски StatusBoard модуля доступа: её адрес лежит
+ * в переменной libVLC STATUS_BOARD_VAR, чтение — без блокировок.
  *****************************************************************************/
 
 #ifdef HAVE_CONFIG_H
@@ -20,6 +21,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "status.h"
+
 #define MODULE_NAME 3_0_0f
 #ifndef MODULE_STRING
 # define MODULE_STRING "bittorrent_overlay"
@@ -32,14 +35,26 @@ static int           Open  (vlc_object_t *);
 static void          Close (vlc_object_t *);
 static subpicture_t* Render(filter_t *, mtime_t);
 
+// Сколько держится на экране одна субкартинка. Пока текст не меняется,
+// новую не строим, а прежнюю переиздаём за половину этого срока
+#define OVERLAY_HOLD (10 * CLOCK_FREQ)
+
 // ────────────────────────────────────────────────────────────
 // Состояние фильтра
 // ────────────────────────────────────────────────────────────
 typedef struct filter_sys_t {
     libvlc_int_t*  p_libvlc;     // корневой объект (один на процесс)
+    const StatusBoard* board;    // NULL, пока модуль доступа её не отдал
     text_style_t*  style;
     int            margin;
     unsigned       render_calls;
+
+    // Что сейчас на экране: перерисовываем, только если изменилось
+    bool           shown;
+    uint32_t       version;      // версия доски, по которой строили
+    char           text[128];
+    unsigned       width, height;
+    mtime_t        refresh;      // когда переиздать субкартинку
 } filter_sys_t;
 
 // ────────────────────────────────────────────────────────────
@@ -76,8 +91,10 @@ static int Open(vlc_object_t *p_this)
         return VLC_EGENERIC;
     }
 
-    // Гарантируем наличие переменной (если не создана — создадим пустую строковую)
-    var_Create(VLC_OBJECT(p_sys->p_libvlc), "bt_overlay_text", VLC_VAR_STRING);
+    // Гарантируем наличие переменной (если не создана — создадим пустую)
+    var_Create(VLC_OBJECT(p_sys->p_libvlc), STATUS_BOARD_VAR, VLC_VAR_ADDRESS);
+    p_sys->board = (const StatusBoard*)var_GetAddress(VLC_OBJECT(p_sys->p_libvlc),
+                                                      STATUS_BOARD_VAR);
 
     p_sys->style = text_style_New();
     if (!p_sys->style) {
@@ -89,7 +106,7 @@ static int Open(vlc_object_t *p_this)
     p_sys->render_calls = 0;
 
     p_filter->p_sys = p_sys;
-    msg_Dbg(p_filter, MODULE_STRING " sub source opened (using libVLC var 'bt_overlay_text')");
+    msg_Dbg(p_filter, MODULE_STRING " sub source opened (using libVLC var '" STATUS_BOARD_VAR "')");
     return VLC_SUCCESS;
 }
 
@@ -110,31 +127,59 @@ static void Close(vlc_object_t *p_this)
 }
 
 // ────────────────────────────────────────────────────────────
-// Render: читаем текст из libVLC переменной и рисуем субкартинку
+// Render: читаем снимок статуса с доски и рисуем субкартинку
 // ────────────────────────────────────────────────────────────
 static subpicture_t* Render(filter_t *p_filter, mtime_t date)
 {
     filter_sys_t* p_sys = (filter_sys_t*)p_filter->p_sys;
     ++p_sys->render_calls;
 
-    // Берём текущий текст (var_GetString аллоцирует — нужно free())
-    char* s = var_GetString(VLC_OBJECT(p_sys->p_libvlc), "bt_overlay_text");
-
-    if (s == NULL || s[0] == '\0') {
-        if ((p_sys->render_calls % 120) == 0)
-            msg_Dbg(p_filter, "[overlay] no text in 'bt_overlay_text' yet");
-        free(s);
-        return NULL; // ничего не рисуем, пока нет данных
+    // Оверлей мог открыться раньше первого торрента. Переменная берётся
+    // под блокировкой VLC, поэтому спрашиваем её не на каждом кадре
+    if (!p_sys->board) {
+        if ((p_sys->render_calls % 30) != 1)
+            return NULL;
+        p_sys->board = (const StatusBoard*)var_GetAddress(
+            VLC_OBJECT(p_sys->p_libvlc), STATUS_BOARD_VAR);
+        if (!p_sys->board)
+            return NULL;
     }
 
-    // Создаём субкартинку
-    subpicture_t *spu = subpicture_New(NULL);
-    if (!spu) {
-        free(s);
-        msg_Warn(p_filter, "[overlay] subpicture_New failed");
+    // Доска не обновлялась — прежняя субкартинка всё ещё на экране
+    uint32_t version = p_sys->board->version();
+    if (version == p_sys->version && (!p_sys->shown || date < p_sys->refresh))
         return NULL;
+    p_sys->version = version;
+
+    BtStatus st;
+    if (!p_sys->board->read(st) || !st.valid) {
+        if (!p_sys->shown)
+            return NULL; // ничего не рисуем, пока нет данных
+        // Пустая субкартинка в том же канале снимает прежнюю
+        subpicture_t *spu = subpicture_New(NULL);
+        if (!spu)
+            return NULL;
+        spu->i_start = date;
+        spu->i_stop = date + 1;
+        spu->b_ephemer = true;
+        p_sys->shown = false;
+        return spu;
     }
 
+    char s[128];
+    if (st.has_status && st.buffering_pct >= 0)
+        snprintf(s, sizeof(s),
+                 "[BT] Buffering %d%%  D:%lld KiB/s  Peers:%d",
+                 (int)st.buffering_pct, (long long)(st.download_rate / 1024),
+                 (int)st.peers);
+    else if (st.has_status)
+        snprintf(s, sizeof(s),
+                 "[BT] D:%lld KiB/s  U:%lld KiB/s  Peers:%d  Progress:%.2f%%",
+                 (long long)(st.download_rate / 1024), (long long)(st.upload_rate / 1024),
+                 (int)st.peers, st.progress_pct);
+    else
+        snprintf(s, sizeof(s), "[BT] Starting...");
+
     // ────────────────────────────────────────────────────────
     // ИЗМЕНЕНИЕ #1: определяем реальный базовый размер кадра
     // Берём из fmt_out.video; если нули (редко на старте) — используем 1280x720.
@@ -149,6 +194,11 @@ static subpicture_t* Render(filter_t *p_filter, mtime_t date)
     }
     if (w == 0 || h == 0) { w = 1280; h = 720; } // fallback
 
+    // Скорости в снимке обновились, а текст тот же — глифы не трогаем
+    if (p_sys->shown && date < p_sys->refresh && strcmp(s, p_sys->text) == 0
+        && w == p_sys->width && h == p_sys->height)
+        return NULL;
+
     // Подготавливаем текстовый формат региона на основе реального размера
     video_format_t fmt;
     memset(&fmt, 0, sizeof(fmt));
@@ -157,11 +207,17 @@ static subpicture_t* Render(filter_t *p_filter, mtime_t date)
     fmt.i_height = fmt.i_visible_height = h; // ← ИЗМЕНЕНИЕ #2: был константный 720
     fmt.i_sar_num = fmt.i_sar_den = 1;
 
+    // Создаём субкартинку
+    subpicture_t *spu = subpicture_New(NULL);
+    if (!spu) {
+        msg_Warn(p_filter, "[overlay] subpicture_New failed");
+        return NULL;
+    }
+
     subpicture_region_t *r = subpicture_region_New(&fmt);
-    if (!r) { subpicture_Delete(spu); free(s); return NULL; }
+    if (!r) { subpicture_Delete(spu); return NULL; }
 
     text_segment_t *seg = text_segment_New(s);
-    free(s); // строку больше не держим
     if (!seg) { subpicture_region_Delete(r); subpicture_Delete(spu); return NULL; }
 
     if (p_sys->style)
@@ -186,10 +242,17 @@ static subpicture_t* Render(filter_t *p_filter, mtime_t date)
     // (absolute = false — стандартная схема для оверлеев текста)
     spu->b_absolute = false; // ← ИЗМЕНЕНИЕ #4: явно укажем поведение
 
-    // Временные параметры субкартинки
+    // Временные параметры субкартинки: ephemer — держится до следующей
+    // в этом канале, i_stop лишь страхует, если Render перестанут звать
     spu->i_start  = date;
-    spu->i_stop   = date + 500000; // ~0.5 сек
+    spu->i_stop   = date + OVERLAY_HOLD;
     spu->b_ephemer = true;
 
+    p_sys->shown = true;
+    p_sys->refresh = date + OVERLAY_HOLD / 2;
+    p_sys->width = w;
+    p_sys->height = h;
+    strcpy(p_sys->text, s);
+
     return spu;
 }
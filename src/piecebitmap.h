@@ -0,0 +1,114 @@
+/*
+ * src/piecebitmap.h
+ *
+ * Локальная копия битового поля кусков торрента: кусок скачан и прошёл
+ * проверку хэша. have_piece() у torrent_handle — синхронный вызов в поток
+ * сети libtorrent, поэтому путь чтения и планировщик приоритетов смотрят
+ * сюда. Биты ставит поток сессии по piece_finished_alert и снимает по
+ * hash_failed_alert, читают все без блокировок. Пропущенный бит только
+ * замедляет (чтение перепроверит кусок у libtorrent), лишних не бывает.
+ */
+
+#ifndef VLC_BITTORRENT_PIECEBITMAP_H
+#define VLC_BITTORRENT_PIECEBITMAP_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+class PieceBitmap {
+public:
+    // Один раз, когда известно число кусков; до этого куска нет ни одного
+    void
+    init(int num_pieces)
+    {
+        std::call_once(m_once, [&] {
+            size_t words = ((size_t)num_pieces + 63) / 64;
+            m_words.reset(new std::atomic<uint64_t>[words]());
+            m_size = num_pieces;
+            m_ready.store(true, std::memory_order_release);
+        });
+    }
+
+    bool
+    have(int piece) const
+    {
+        if (!valid(piece))
+            return false;
+        return (m_words[(size_t)piece >> 6].load(std::memory_order_acquire)
+                >> (piece & 63)) & 1;
+    }
+
+    void
+    set(int piece)
+    {
+        if (valid(piece))
+            m_words[(size_t)piece >> 6].fetch_or(bit(piece), std::memory_order_release);
+    }
+
+    void
+    clear(int piece)
+    {
+        if (valid(piece))
+            m_words[(size_t)piece >> 6].fetch_and(~bit(piece), std::memory_order_release);
+    }
+
+    // Первый недостающий кусок в [first, last], иначе last + 1. Целые
+    // скачанные слова пропускаются за одну проверку
+    int
+    next_missing(int first, int last) const
+    {
+        if (first < 0)
+            first = 0;
+        if (!m_ready.load(std::memory_order_acquire))
+            return first <= last ? first : last + 1;
+
+        int end = last < m_size ? last : m_size - 1;
+        for (int p = first; p <= end;) {
+            uint64_t missing = ~m_words[(size_t)p >> 6].load(std::memory_order_acquire)
+                               >> (p & 63);
+            if (missing) {
+                int q = p + ctz(missing);
+                return q <= end ? q : last + 1;
+            }
+            p = (p | 63) + 1;
+        }
+        return last + 1;
+    }
+
+private:
+    bool
+    valid(int piece) const
+    {
+        return m_ready.load(std::memory_order_acquire) && piece >= 0 && piece < m_size;
+    }
+
+    static uint64_t
+    bit(int piece)
+    {
+        return (uint64_t)1 << (piece & 63);
+    }
+
+    static int
+    ctz(uint64_t v)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctzll(v);
+#else
+        int n = 0;
+        while (!(v & 1)) {
+            v >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
+
+    std::once_flag m_once;
+    std::atomic<bool> m_ready{false};
+    std::unique_ptr<std::atomic<uint64_t>[]> m_words;
+    int m_size = 0;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * src/piececache.cpp
+ *
+ * Реализация LRU-кэша кусков. Все операции выполняются под одним
+ * мьютексом: сами операции — это поиск в хэш-таблице и перестановка
+ * узла списка, поэтому удержание блокировки короткое.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "piececache.h"
+
+PieceCache::PieceCache(size_t capacity)
+    : m_capacity(capacity)
+{
+}
+
+bool
+PieceCache::get(int piece, Buffer& buffer, int& size)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+
+    auto it = m_index.find(piece);
+    if (it == m_index.end()) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    buffer = it->second->buffer;
+    size = it->second->size;
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool
+PieceCache::peek(int piece, Buffer& buffer, int& size) const
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+
+    auto it = m_index.find(piece);
+    if (it == m_index.end())
+        return false;
+
+    buffer = it->second->buffer;
+    size = it->second->size;
+    return true;
+}
+
+bool
+PieceCache::contains(int piece) const
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    return m_index.count(piece) > 0;
+}
+
+void
+PieceCache::put(int piece, Buffer buffer, int size)
+{
+    if (!buffer || size <= 0)
+        return;
+
+    std::lock_guard<std::mutex> lg(m_mtx);
+
+    auto it = m_index.find(piece);
+    if (it != m_index.end()) {
+        m_size -= (size_t) it->second->size;
+        m_lru.erase(it->second);
+        m_index.erase(it);
+    }
+
+    m_lru.push_front(Entry { piece, std::move(buffer), size });
+    m_index[piece] = m_lru.begin();
+    m_size += (size_t) size;
+
+    evict();
+}
+
+void
+PieceCache::erase(int piece)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+
+    auto it = m_index.find(piece);
+    if (it == m_index.end())
+        return;
+
+    m_size -= (size_t) it->second->size;
+    m_lru.erase(it->second);
+    m_index.erase(it);
+}
+
+void
+PieceCache::clear()
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+
+    m_lru.clear();
+    m_index.clear();
+    m_size = 0;
+}
+
+void
+PieceCache::set_capacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+
+    m_capacity = capacity;
+    evict();
+}
+
+size_t
+PieceCache::capacity() const
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    return m_capacity;
+}
+
+void
+PieceCache::evict()
+{
+    // Самый свежий кусок не вытесняем никогда, даже если он один больше
+    // лимита: иначе при кусках 16 МиБ и маленьком лимите кэш бесполезен
+    while (m_size > m_capacity && m_lru.size() > 1) {
+        auto& e = m_lru.back();
+        m_size -= (size_t) e.size;
+        m_index.erase(e.piece);
+        m_lru.pop_back();
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * src/piececache.h
+ *
+ * Ограниченный по памяти LRU-кэш прочитанных кусков (pieces) торрента.
+ * Ключ — индекс куска, значение — буфер, полученный из read_piece_alert.
+ * Позволяет обслуживать последовательные мелкие чтения VLC внутри одного
+ * куска простым memcpy, без повторного read_piece через libtorrent.
+ */
+
+#ifndef VLC_BITTORRENT_PIECECACHE_H
+#define VLC_BITTORRENT_PIECECACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include <boost/shared_array.hpp>
+
+class PieceCache {
+public:
+    using Buffer = boost::shared_array<char>;
+
+    explicit PieceCache(size_t capacity);
+
+    PieceCache(const PieceCache&) = delete;
+    PieceCache& operator=(const PieceCache&) = delete;
+
+    // Возвращает true и буфер куска, если он есть в кэше
+    bool
+    get(int piece, Buffer& buffer, int& size);
+
+    // То же, что get(), но не трогает статистику и порядок вытеснения
+    bool
+    peek(int piece, Buffer& buffer, int& size) const;
+
+    bool
+    contains(int piece) const;
+
+    void
+    put(int piece, Buffer buffer, int size);
+
+    void
+    erase(int piece);
+
+    void
+    clear();
+
+    void
+    set_capacity(size_t capacity);
+
+    size_t
+    capacity() const;
+
+    uint64_t
+    hits() const
+    {
+        return m_hits.load(std::memory_order_relaxed);
+    }
+
+    uint64_t
+    misses() const
+    {
+        return m_misses.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Entry {
+        int piece;
+        Buffer buffer;
+        int size;
+    };
+
+    // Вызывается с захваченным m_mtx
+    void
+    evict();
+
+    mutable std::mutex m_mtx;
+
+    // Голова списка — самый свежий кусок
+    std::list<Entry> m_lru;
+    std::unordered_map<int, std::list<Entry>::iterator> m_index;
+
+    size_t m_capacity;
+    size_t m_size = 0;
+
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+};
+
+#endif
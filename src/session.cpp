@@ -2,14 +2,29 @@
  * src/session.cpp
  *
  * Реализация синглтона Session. Запускает поток, который в цикле
- * ожидает и рассылает алерты от libtorrent всем подписчикам.
+ * ожидает алерты от libtorrent и доставляет каждый из них подписчикам
+ * его ключа (тип, infohash, кусок).
  */
 
 #include "session.h"
 #include <libtorrent/alert.hpp>
+#include <libtorrent/bdecode.hpp>
+#include <libtorrent/bencode.hpp>
+#include <libtorrent/entry.hpp>
+#include <libtorrent/hex.hpp>
 #include <libtorrent/session.hpp>
 #include <libtorrent/alert_types.hpp>
+#include <libtorrent/version.hpp>
+#if LIBTORRENT_VERSION_NUM >= 20000
+#include <libtorrent/session_params.hpp>
+#endif
+#include <algorithm>
 #include <chrono>
+#include <limits>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
 #include <vector>
 
 #define LIBTORRENT_ADD_TORRENT_ALERTS \
@@ -27,7 +42,105 @@
      "router.utorrent.com:6881,"      \
      "dht.transmissionbt.com:6881")
 
-Session::Session()
+#ifdef _WIN32
+#define STATE_DIR_SEP "\\"
+#else
+#define STATE_DIR_SEP "/"
+#endif
+
+#define SESSION_STATE_FILE "session.state"
+#define PEER_CACHE_FILE    "peers.txt"
+
+// Сколько торрентов и пиров на торрент помнит кэш пиров
+#define PEER_CACHE_TORRENTS 64
+#define PEER_CACHE_PEERS    32
+
+// Профиль настроек: диск, потоки ввода-вывода и пиры подбираются вместе.
+// Дисковый кэш libtorrent 2.0 — это кэш страниц ОС, поэтому cache_size
+// задаётся только для 1.2
+static void
+apply_profile(lt::settings_pack& sp, const std::string& profile)
+{
+    if (profile == "seek") {
+        // Быстрый старт и перемотка: короткие таймауты, частые новые
+        // соединения, небольшая очередь к диску, чтобы свежие срочные
+        // куски не стояли за старыми
+        sp.set_int(sp.request_timeout, 2);
+        sp.set_int(sp.piece_timeout, 5);
+        sp.set_int(sp.peer_connect_timeout, 5);
+        sp.set_int(sp.connection_speed, 50);
+        sp.set_int(sp.request_queue_time, 1);
+        sp.set_int(sp.whole_pieces_threshold, 5);
+        sp.set_int(sp.max_out_request_queue, 500);
+        sp.set_int(sp.connections_limit, 200);
+        sp.set_int(sp.aio_threads, 4);
+#if LIBTORRENT_VERSION_NUM >= 20000
+        sp.set_int(sp.hashing_threads, 2);
+#endif
+        sp.set_int(sp.max_queued_disk_bytes, 4 * 1024 * 1024);
+        sp.set_int(sp.send_buffer_watermark, 1024 * 1024);
+#if LIBTORRENT_VERSION_NUM < 20000
+        sp.set_int(sp.cache_size, 2048);  // в блоках по 16 КиБ
+        sp.set_int(sp.cache_expiry, 60);
+#endif
+    } else if (profile == "lan") {
+        // Быстрые пиры рядом: глубокие очереди запросов и большие буферы,
+        // чтобы канал не простаивал, больше потоков диска под SSD/RAID
+        sp.set_int(sp.request_timeout, 5);
+        sp.set_int(sp.request_queue_time, 3);
+        sp.set_int(sp.whole_pieces_threshold, 20);
+        sp.set_int(sp.max_out_request_queue, 1500);
+        sp.set_int(sp.max_allowed_in_request_queue, 2000);
+        sp.set_int(sp.connections_limit, 500);
+        sp.set_int(sp.unchoke_slots_limit, 32);
+        sp.set_int(sp.aio_threads, 16);
+#if LIBTORRENT_VERSION_NUM >= 20000
+        sp.set_int(sp.hashing_threads, 8);
+#endif
+        sp.set_int(sp.max_queued_disk_bytes, 64 * 1024 * 1024);
+        sp.set_int(sp.send_buffer_watermark, 8 * 1024 * 1024);
+        sp.set_int(sp.send_buffer_low_watermark, 1024 * 1024);
+        sp.set_int(sp.send_buffer_watermark_factor, 150);
+        sp.set_int(sp.recv_socket_buffer_size, 4 * 1024 * 1024);
+        sp.set_int(sp.send_socket_buffer_size, 4 * 1024 * 1024);
+        sp.set_int(sp.mixed_mode_algorithm, lt::settings_pack::prefer_tcp);
+        sp.set_bool(sp.enable_lsd, true);
+        sp.set_bool(sp.allow_multiple_connections_per_ip, true);
+#if LIBTORRENT_VERSION_NUM < 20000
+        sp.set_int(sp.cache_size, 16384);
+        sp.set_int(sp.cache_expiry, 300);
+#endif
+    } else if (profile == "embedded") {
+        // Приставки: мало памяти и слабый процессор. Немного пиров,
+        // маленькие буферы и один поток диска
+        sp.set_int(sp.connections_limit, 50);
+        sp.set_int(sp.unchoke_slots_limit, 4);
+        sp.set_int(sp.max_peerlist_size, 500);
+        sp.set_int(sp.max_out_request_queue, 100);
+        sp.set_int(sp.max_allowed_in_request_queue, 100);
+        sp.set_int(sp.aio_threads, 1);
+#if LIBTORRENT_VERSION_NUM >= 20000
+        sp.set_int(sp.hashing_threads, 1);
+#endif
+        sp.set_int(sp.file_pool_size, 8);
+        sp.set_int(sp.checking_mem_usage, 64);
+        sp.set_int(sp.max_queued_disk_bytes, 1024 * 1024);
+        sp.set_int(sp.send_buffer_watermark, 128 * 1024);
+        sp.set_int(sp.send_buffer_low_watermark, 16 * 1024);
+        sp.set_int(sp.recv_socket_buffer_size, 64 * 1024);
+        sp.set_int(sp.send_socket_buffer_size, 64 * 1024);
+#if LIBTORRENT_VERSION_NUM < 20000
+        sp.set_int(sp.cache_size, 256);
+        sp.set_int(sp.cache_expiry, 30);
+#endif
+    }
+}
+
+// Полный набор настроек: значения по умолчанию, общие для плагина
+// и профиль поверх них. Начинаем с default_settings(), чтобы при смене
+// профиля не оставалось значений от предыдущего
+static lt::settings_pack
+make_settings(const std::string& profile)
 {
     lt::settings_pack sp = lt::default_settings();
     sp.set_int(sp.alert_mask, LIBTORRENT_ADD_TORRENT_ALERTS);
@@ -41,33 +154,394 @@ Session::Session()
     sp.set_int(sp.whole_pieces_threshold, 5);
     sp.set_int(sp.request_queue_time, 1);
 
+    apply_profile(sp, profile);
+    return sp;
+}
+
+// Поток без чтений дольше этого (пауза, свёрнутое превью) — background
+#define FG_IDLE_TIMEOUT 10
+// Запас к битрейту foreground-потока, прежде чем делиться каналом
+#define FG_HEADROOM_PCT 150
+// Минимум для background: торрент не должен терять всех пиров
+#define BG_MIN_RATE (32 * 1024)
+#define BG_CONNECTIONS 8
+// Пиковая оценка канала затухает на столько процентов за обновление
+#define CAPACITY_DECAY_PCT 5
+
+static std::mutex  s_state_mtx;
+static std::string s_state_dir;
+
+static std::vector<char>
+read_file(const std::string& path)
+{
+    std::ifstream is(path, std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(is)),
+                             std::istreambuf_iterator<char>());
+}
+
+// Через временный файл: оборванная запись не испортит прежнюю версию
+static void
+write_file(const std::string& path, const std::vector<char>& buf)
+{
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+        os.write(buf.data(), (std::streamsize)buf.size());
+        if (!os) {
+            os.close();
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    if (std::rename(tmp.c_str(), path.c_str()))
+        std::remove(tmp.c_str());
+}
+
+void Session::set_state_directory(const std::string& dir)
+{
+    std::lock_guard<std::mutex> lg(s_state_mtx);
+    if (s_state_dir.empty())
+        s_state_dir = dir;
+}
+
+Session::Session()
+{
+    {
+        std::lock_guard<std::mutex> lg(s_state_mtx);
+        m_state_dir = s_state_dir;
+    }
+
+    m_profile = "default";
+    lt::settings_pack sp = make_settings(m_profile);
+
+    // Таблица DHT и настройки прошлого запуска: по magnet-ссылке не надо
+    // заново ждать, пока DHT прогреется от трёх bootstrap-узлов. Наши
+    // настройки применяются поверх сохранённых
+    std::vector<char> state;
+    if (!m_state_dir.empty())
+        state = read_file(m_state_dir + STATE_DIR_SEP SESSION_STATE_FILE);
+    auto const state_flags = lt::session::save_dht_state | lt::session::save_settings;
+
+#if LIBTORRENT_VERSION_NUM >= 20000
+    lt::session_params params(sp);
+    if (!state.empty()) {
+        try {
+            params = lt::read_session_params(
+                { state.data(), static_cast<std::ptrdiff_t>(state.size()) }, state_flags);
+        } catch (...) {
+            params = lt::session_params(sp);
+        }
+    }
+    m_session = std::make_unique<lt::session>(std::move(params));
+    m_session->apply_settings(sp);
+#else
     m_session = std::make_unique<lt::session>(sp);
+    if (!state.empty()) {
+        lt::bdecode_node node;
+        lt::error_code ec;
+        if (lt::bdecode(state.data(), state.data() + state.size(), node, ec) == 0) {
+            m_session->load_state(node, state_flags);
+            m_session->apply_settings(sp);
+        }
+    }
+#endif
+
+    load_peers();
+
     m_session_thread = std::thread(&Session::session_thread, this);
 }
 
+void Session::set_profile(const std::string& name)
+{
+    std::lock_guard<std::mutex> lg(m_profile_mtx);
+    if (name == m_profile)
+        return;
+    m_profile = name;
+    m_session->apply_settings(make_settings(name));
+}
+
+void Session::register_stream(const lt::sha1_hash& ih, const lt::torrent_handle& th)
+{
+    std::lock_guard<std::mutex> lg(m_streams_mtx);
+    m_streams[ih].th = th;
+}
+
+void Session::unregister_stream(const lt::sha1_hash& ih)
+{
+    std::lock_guard<std::mutex> lg(m_streams_mtx);
+    m_streams.erase(ih);
+}
+
+void Session::set_stream_class(const lt::sha1_hash& ih, StreamClass cls)
+{
+    std::lock_guard<std::mutex> lg(m_streams_mtx);
+    auto it = m_streams.find(ih);
+    if (it == m_streams.end())
+        return;
+    it->second.cls = cls;
+    if (cls == StreamClass::foreground)
+        it->second.last_read = std::chrono::steady_clock::now();
+}
+
+void Session::stream_active(const lt::sha1_hash& ih, int64_t bytes_per_sec, bool missing)
+{
+    std::lock_guard<std::mutex> lg(m_streams_mtx);
+    auto it = m_streams.find(ih);
+    if (it == m_streams.end())
+        return;
+    it->second.last_read = std::chrono::steady_clock::now();
+    it->second.missing = missing;
+    if (bytes_per_sec > 0)
+        it->second.need = bytes_per_sec;
+}
+
+void Session::stream_buffering(const lt::sha1_hash& ih, int pct)
+{
+    std::lock_guard<std::mutex> lg(m_streams_mtx);
+    auto it = m_streams.find(ih);
+    if (it != m_streams.end())
+        it->second.buffering = pct;
+}
+
+// Foreground без ограничений. Background делит то, что остаётся от
+// оценки канала за вычетом битрейтов foreground с запасом. Если хоть один
+// foreground голодает — ждёт кусков срочной части окна и не успевает за
+// своим битрейтом (или битрейт неизвестен), — background получают только
+// минимум. Скачанный целиком или успевший буферизоваться поток не голодает
+void Session::rebalance(const std::vector<lt::torrent_status>& status)
+{
+    for (auto const& st : status) {
+#if LIBTORRENT_VERSION_NUM >= 20000
+        auto it = m_streams.find(st.info_hashes.v1);
+#else
+        auto it = m_streams.find(st.info_hash);
+#endif
+        if (it == m_streams.end())
+            continue;
+        Stream& s = it->second;
+        s.rate = st.download_payload_rate;
+        s.done = st.is_finished || st.is_seeding;
+        s.status.has_status = 1;
+        s.status.state = (int32_t)st.state;
+        s.status.peers = st.num_peers;
+        s.status.download_rate = st.download_payload_rate;
+        s.status.upload_rate = st.upload_payload_rate;
+        s.status.progress_pct = (double)st.progress * 100.0;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto idle = std::chrono::seconds(FG_IDLE_TIMEOUT);
+    int64_t total = 0, fg_need = 0;
+    size_t num_fg = 0, num_bg = 0;
+    bool starved = false;
+    for (auto& kv : m_streams) {
+        Stream& s = kv.second;
+        total += s.rate;
+        if (s.cls == StreamClass::foreground && now - s.last_read < idle) {
+            num_fg++;
+            if (s.missing && !s.done && (s.need <= 0 || s.rate < s.need))
+                starved = true;
+            fg_need += s.need * FG_HEADROOM_PCT / 100;
+        } else {
+            num_bg++;
+        }
+    }
+    m_capacity = std::max(total, m_capacity - m_capacity * CAPACITY_DECAY_PCT / 100);
+
+    int bg_limit = -1, bg_connections = -1;
+    if (num_fg > 0 && num_bg > 0) {
+        int64_t budget = starved ? 0 : (m_capacity - fg_need) / (int64_t)num_bg;
+        bg_limit = (int)std::min<int64_t>(std::max<int64_t>(budget, BG_MIN_RATE),
+                                          std::numeric_limits<int>::max());
+        bg_connections = BG_CONNECTIONS;
+    }
+
+    for (auto& kv : m_streams) {
+        Stream& s = kv.second;
+        bool fg = s.cls == StreamClass::foreground && now - s.last_read < idle;
+        int limit = fg ? -1 : bg_limit;
+        int connections = fg ? -1 : bg_connections;
+        if (!s.th.is_valid())
+            continue;
+        // Handle-вызовы асинхронные, но зря их не шлём
+        if (limit != s.limit) {
+            s.th.set_download_limit(limit);
+            s.limit = limit;
+        }
+        if (connections != s.connections) {
+            s.th.set_max_connections(connections);
+            s.connections = connections;
+        }
+    }
+}
+
+StatusBoard& Session::status_board()
+{
+    static StatusBoard board;
+    return board;
+}
+
+// Сюда state_update_alert приносит только изменившиеся торренты, поэтому
+// статус берём из сохранённого в Stream
+void Session::publish_status()
+{
+    const Stream* cur = nullptr;
+    for (auto const& kv : m_streams) {
+        const Stream& s = kv.second;
+        if (s.cls != StreamClass::foreground)
+            continue;
+        if (!cur || s.last_read > cur->last_read)
+            cur = &s;
+    }
+
+    BtStatus st{};
+    st.buffering_pct = -1;
+    if (cur) {
+        st = cur->status;
+        st.valid = 1;
+        st.buffering_pct = cur->buffering;
+    }
+    status_board().publish(st);
+}
+
 Session::~Session()
 {
+    save_state();
+    save_peers();
+
     m_quit = true;
     m_session->abort();
     if (m_session_thread.joinable())
         m_session_thread.join();
 }
 
-void Session::register_alert_listener(Alert_Listener* al)
+void Session::save_state()
+{
+    if (m_state_dir.empty())
+        return;
+
+    auto const state_flags = lt::session::save_dht_state | lt::session::save_settings;
+#if LIBTORRENT_VERSION_NUM >= 20000
+    std::vector<char> buf = lt::write_session_params_buf(
+        m_session->session_state(state_flags), state_flags);
+#else
+    lt::entry e;
+    m_session->save_state(e, state_flags);
+    std::vector<char> buf;
+    lt::bencode(std::back_inserter(buf), e);
+#endif
+    write_file(m_state_dir + STATE_DIR_SEP SESSION_STATE_FILE, buf);
+}
+
+// Формат: строка на торрент — infohash, затем пары «адрес порт»
+void Session::load_peers()
+{
+    if (m_state_dir.empty())
+        return;
+
+    std::ifstream is(m_state_dir + STATE_DIR_SEP PEER_CACHE_FILE);
+    std::string line;
+    std::lock_guard<std::mutex> lg(m_peers_mtx);
+    while (std::getline(is, line) && m_peers.size() < PEER_CACHE_TORRENTS) {
+        std::istringstream ls(line);
+        std::string ih, addr;
+        unsigned short port;
+        if (!(ls >> ih))
+            continue;
+        std::vector<lt::tcp::endpoint> peers;
+        while (ls >> addr >> port && peers.size() < PEER_CACHE_PEERS) {
+            boost::system::error_code ec;
+            auto a = boost::asio::ip::make_address(addr, ec);
+            if (!ec)
+                peers.emplace_back(a, port);
+        }
+        if (!peers.empty())
+            m_peers.emplace_back(ih, std::move(peers));
+    }
+}
+
+void Session::save_peers()
+{
+    if (m_state_dir.empty())
+        return;
+
+    std::ostringstream os;
+    {
+        std::lock_guard<std::mutex> lg(m_peers_mtx);
+        for (auto const& t : m_peers) {
+            os << t.first;
+            for (auto const& ep : t.second)
+                os << ' ' << ep.address().to_string() << ' ' << ep.port();
+            os << '\n';
+        }
+    }
+    std::string str = os.str();
+    write_file(m_state_dir + STATE_DIR_SEP PEER_CACHE_FILE,
+               std::vector<char>(str.begin(), str.end()));
+}
+
+void Session::remember_peers(const lt::sha1_hash& ih,
+                             const std::vector<lt::tcp::endpoint>& peers)
+{
+    if (peers.empty())
+        return;
+
+    std::string key = lt::aux::to_hex(ih.to_string());
+    std::lock_guard<std::mutex> lg(m_peers_mtx);
+    for (auto it = m_peers.begin(); it != m_peers.end(); ++it) {
+        if (it->first == key) {
+            m_peers.erase(it);
+            break;
+        }
+    }
+    m_peers.emplace_front(key, peers);
+    if (m_peers.front().second.size() > PEER_CACHE_PEERS)
+        m_peers.front().second.resize(PEER_CACHE_PEERS);
+    while (m_peers.size() > PEER_CACHE_TORRENTS)
+        m_peers.pop_back();
+}
+
+std::vector<lt::tcp::endpoint> Session::known_peers(const lt::sha1_hash& ih)
+{
+    std::string key = lt::aux::to_hex(ih.to_string());
+    std::lock_guard<std::mutex> lg(m_peers_mtx);
+    for (auto const& t : m_peers) {
+        if (t.first == key)
+            return t.second;
+    }
+    return {};
+}
+
+Session::Shard& Session::shard(const AlertKey& key)
+{
+    return m_shards[AlertKeyHash()(key) % NUM_SHARDS];
+}
+
+void Session::subscribe(const AlertKey& key, Alert_Listener* al)
 {
-    std::lock_guard<std::mutex> lg(m_listeners_mtx);
-    m_listeners.push_front(al);
+    Shard& sh = shard(key);
+    std::lock_guard<std::mutex> lg(sh.mtx);
+    sh.listeners[key].push_front(al);
 }
 
-void Session::unregister_alert_listener(Alert_Listener* al)
+void Session::unsubscribe(const AlertKey& key, Alert_Listener* al)
 {
-    std::lock_guard<std::mutex> lg(m_listeners_mtx);
-    m_listeners.remove(al);
+    Shard& sh = shard(key);
+    std::lock_guard<std::mutex> lg(sh.mtx);
+    auto it = sh.listeners.find(key);
+    if (it == sh.listeners.end())
+        return;
+    it->second.remove(al);
+    if (it->second.empty())
+        sh.listeners.erase(it);
 }
 
-lt::torrent_handle Session::add_torrent(lt::add_torrent_params& atp)
+void Session::async_add_torrent(const lt::add_torrent_params& atp)
 {
-    return m_session->add_torrent(atp);
+    m_session->async_add_torrent(atp);
 }
 
 void Session::remove_torrent(lt::torrent_handle& th, bool keep)
@@ -78,6 +552,13 @@ void Session::remove_torrent(lt::torrent_handle& th, bool keep)
         m_session->remove_torrent(th, lt::session::delete_files);
 }
 
+void Session::remove_torrent(const lt::sha1_hash& ih, bool keep)
+{
+    lt::torrent_handle th = m_session->find_torrent(ih);
+    if (th.is_valid())
+        remove_torrent(th, keep);
+}
+
 void Session::session_thread()
 {
     while (!m_quit) {
@@ -90,14 +571,88 @@ void Session::session_thread()
         std::vector<lt::alert*> alerts;
         m_session->pop_alerts(&alerts);
 
-        std::lock_guard<std::mutex> lg(m_listeners_mtx);
-        for (auto* a : alerts) {
-            for (auto* h : m_listeners) {
-                try { h->handle_alert(a); }
-                catch (...) {}
-            }
-        }
+        // Очередь, которая растёт, и долгий разбор задерживают все
+        // read_piece_alert и piece_finished_alert разом
+        m_alert_batch.record((uint64_t)alerts.size());
+        StageTimer t(m_dispatch_time);
+        for (auto* a : alerts)
+            dispatch(a);
+    }
+}
+
+std::string Session::stats_text() const
+{
+    return m_alert_batch.format("alert_batch", false) + "\n"
+           + m_dispatch_time.format("alert_dispatch", true) + "\n";
+}
+
+void Session::dispatch(const AlertKey& key, lt::alert* a)
+{
+    // Подписчик вызывается под мьютексом шарда: после unsubscribe()
+    // ни один его handle_alert() уже не выполняется
+    Shard& sh = shard(key);
+    std::lock_guard<std::mutex> lg(sh.mtx);
+    auto it = sh.listeners.find(key);
+    if (it == sh.listeners.end())
+        return;
+    for (auto* h : it->second) {
+        try { h->handle_alert(a); }
+        catch (...) {}
+    }
+}
+
+void Session::dispatch(lt::alert* a)
+{
+    AlertKey key { a->type(), lt::sha1_hash(), AlertKey::ANY_PIECE };
+
+    if (auto* x = lt::alert_cast<lt::torrent_removed_alert>(a)) {
+        // Торрент уже удалён, handle недействителен — infohash есть в алерте
+#if LIBTORRENT_VERSION_NUM >= 20000
+        key.ih = x->info_hashes.v1;
+#else
+        key.ih = x->info_hash;
+#endif
+    } else if (auto* x = lt::alert_cast<lt::add_torrent_alert>(a)) {
+        // При ошибке handle пустой — infohash берём из параметров
+#if LIBTORRENT_VERSION_NUM >= 20000
+        key.ih = x->params.ti ? x->params.ti->info_hashes().v1
+                              : x->params.info_hashes.v1;
+#else
+        key.ih = x->params.ti ? x->params.ti->info_hash() : x->params.info_hash;
+#endif
+    } else if (auto* x = dynamic_cast<lt::torrent_alert*>(a)) {
+#if LIBTORRENT_VERSION_NUM >= 20000
+        key.ih = x->handle.info_hashes().v1;
+#else
+        key.ih = x->handle.info_hash();
+#endif
+    } else if (auto* x = lt::alert_cast<lt::state_update_alert>(a)) {
+        std::lock_guard<std::mutex> lg(m_streams_mtx);
+        rebalance(x->status);
+        publish_status();
+        return;
+    } else {
+        // Прочие алерты без торрента (DHT, сессия) пока никому не нужны
+        return;
+    }
+
+    int piece = AlertKey::ANY_PIECE;
+    if (auto* x = lt::alert_cast<lt::read_piece_alert>(a))
+        piece = static_cast<int>(x->piece);
+    else if (auto* x = lt::alert_cast<lt::piece_finished_alert>(a))
+        piece = static_cast<int>(x->piece_index);
+    else if (auto* x = lt::alert_cast<lt::hash_failed_alert>(a))
+        piece = static_cast<int>(x->piece_index);
+    else if (auto* x = lt::alert_cast<lt::block_finished_alert>(a))
+        piece = static_cast<int>(x->piece_index);
+
+    // Сначала подписчики конкретного куска, затем — всего торрента
+    if (piece != AlertKey::ANY_PIECE) {
+        AlertKey pkey = key;
+        pkey.piece = piece;
+        dispatch(pkey, a);
     }
+    dispatch(key, a);
 }
 
 std::shared_ptr<Session> Session::get()
@@ -7,8 +7,10 @@
  *
  * Роль в проекте: Простой и надежный диспетчер алертов.
  * Его единственная задача - запустить сессию libtorrent в отдельном потоке,
- * ловить все асинхронные события (алерты) и пересылать их всем
- * зарегистрированным подписчикам (Alert_Listener).
+ * ловить все асинхронные события (алерты) и пересылать их подписчикам
+ * (Alert_Listener). Подписка оформляется на ключ (тип алерта, infohash,
+ * кусок), поэтому каждый алерт доставляется только тем, кто его ждёт,
+ * за O(1) поиском, без перебора всех подписчиков.
  * Он не содержит никакой логики, специфичной для плагина, что делает его
  * универсальным и стабильным.
  */
@@ -16,12 +18,21 @@
 #ifndef VLC_BITTORRENT_LIBTORRENT_H
 #define VLC_BITTORRENT_LIBTORRENT_H
 
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <forward_list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <atomic>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-conversion"
@@ -29,38 +40,169 @@
 #include <libtorrent/alert.hpp>
 #include <libtorrent/session.hpp>
 #include <libtorrent/torrent_handle.hpp>
+#include <libtorrent/torrent_status.hpp>
 #include <libtorrent/sha1_hash.hpp>
 #pragma GCC diagnostic pop
 
+#include "stats.h"
+#include "status.h"
+
 // Интерфейс для получения алертов из libtorrent
 struct Alert_Listener {
     virtual ~Alert_Listener() = default;
     virtual void handle_alert(lt::alert* a) = 0;
 };
 
+// Ключ подписки на алерты. Для алертов уровня торрента, а также чтобы
+// получать алерты обо всех кусках торрента, piece = ANY_PIECE.
+struct AlertKey {
+    static const int ANY_PIECE = -1;
+
+    int type;
+    lt::sha1_hash ih;
+    int piece;
+
+    bool operator==(const AlertKey& o) const
+    {
+        return type == o.type && piece == o.piece && ih == o.ih;
+    }
+};
+
+struct AlertKeyHash {
+    size_t operator()(const AlertKey& k) const
+    {
+        // infohash и так равномерно распределён — берём его первые байты
+        size_t h;
+        std::memcpy(&h, k.ih.data(), sizeof(h));
+        return h ^ ((size_t) (unsigned) k.type * (size_t) 0x9e3779b97f4a7c15ULL)
+                 ^ ((size_t) (unsigned) k.piece << 16);
+    }
+};
+
+// Класс потока для распределения канала между торрентами. Foreground —
+// тот, что сейчас смотрят: ему под окно дедлайнов канал отдаётся первым.
+// Background — всё остальное (превью, предзагрузка метаданных, торренты,
+// ждущие в пуле Download)
+enum class StreamClass { foreground, background };
+
 class Session {
 public:
     static std::shared_ptr<Session> get();
     ~Session();
 
     // Alert-API
-    void register_alert_listener(Alert_Listener* al);
-    void unregister_alert_listener(Alert_Listener* al);
+    void subscribe(const AlertKey& key, Alert_Listener* al);
+    void unsubscribe(const AlertKey& key, Alert_Listener* al);
+
+    // Каталог, где хранится состояние сессии (DHT, настройки) и кэш пиров
+    // между запусками VLC. Учитывается только до первого get()
+    static void set_state_directory(const std::string& dir);
+
+    // Профиль настроек libtorrent: "default", "seek", "lan", "embedded".
+    // Применяется сразу, в том числе к уже добавленным торрентам;
+    // неизвестное имя равносильно "default"
+    void set_profile(const std::string& name);
+
+    // Кэш пиров: те, что отдавали данные в прошлый раз, подключаются
+    // сразу при добавлении торрента, не дожидаясь трекеров и DHT
+    void remember_peers(const lt::sha1_hash& ih,
+                        const std::vector<lt::tcp::endpoint>& peers);
+    std::vector<lt::tcp::endpoint> known_peers(const lt::sha1_hash& ih);
+
+    // Распределение канала. Торрент регистрируется как background;
+    // foreground, пока его читают: если чтений нет дольше FG_IDLE_TIMEOUT
+    // (пауза), он снова считается background. Ограничения пересчитываются
+    // в потоке сессии по каждому state_update_alert
+    void register_stream(const lt::sha1_hash& ih, const lt::torrent_handle& th);
+    void unregister_stream(const lt::sha1_hash& ih);
+    void set_stream_class(const lt::sha1_hash& ih, StreamClass cls);
+    // Чтение из потока; bytes_per_sec — битрейт, 0 — неизвестен;
+    // missing — в срочной части окна чтения есть нескачанные куски
+    void stream_active(const lt::sha1_hash& ih, int64_t bytes_per_sec, bool missing);
+    // Чтение ждёт кусок, скачанный на pct%; -1 — не ждёт. Попадает
+    // в статус вместе со следующим state_update_alert
+    void stream_buffering(const lt::sha1_hash& ih, int pct);
+
+    // Статус потока, который сейчас смотрят (последнего читавшегося
+    // foreground), обновляется потоком сессии. Доска живёт до выхода
+    // из процесса, её адрес можно отдавать другим модулям
+    static StatusBoard& status_board();
 
-    // Torrent-API
-    lt::torrent_handle add_torrent(lt::add_torrent_params& atp);
+    // Гистограммы потока сессии: сколько алертов за один pop_alerts()
+    // и сколько длился их разбор. Строки "name n=… p50=…", см. Histogram
+    std::string stats_text() const;
+
+    // Torrent-API. Результат добавления приходит как add_torrent_alert
+    // с infohash из параметров, даже если добавить не удалось
+    void async_add_torrent(const lt::add_torrent_params& atp);
     void remove_torrent(lt::torrent_handle& th, bool keep);
+    // По infohash, если торрент есть в сессии. Поиск выполняется в потоке
+    // сети после уже отправленных туда добавлений, так что и добавление,
+    // чьего алерта не дождались, будет найдено
+    void remove_torrent(const lt::sha1_hash& ih, bool keep);
 
 private:
     Session(); // Конструктор теперь приватный для синглтона Мейерса
 
     void session_thread();
 
+    void dispatch(lt::alert* a);
+    void dispatch(const AlertKey& key, lt::alert* a);
+
+    // Вызываются с захваченным m_streams_mtx
+    void rebalance(const std::vector<lt::torrent_status>& status);
+    void publish_status();
+
+    void load_peers();
+    void save_peers();
+    void save_state();
+
+    // Таблица подписчиков разбита на шарды по хэшу ключа: регистрация из
+    // Download::read и доставка алертов в потоке сессии конкурируют только
+    // тогда, когда попадают в один шард
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<AlertKey, std::forward_list<Alert_Listener*>,
+                           AlertKeyHash> listeners;
+    };
+    static const size_t NUM_SHARDS = 16;
+
+    Shard& shard(const AlertKey& key);
+
     std::unique_ptr<lt::session>       m_session;
     std::thread                        m_session_thread;
     std::atomic<bool>                  m_quit{false};
-    std::forward_list<Alert_Listener*> m_listeners;
-    std::mutex                         m_listeners_mtx;
+    std::array<Shard, NUM_SHARDS>      m_shards;
+
+    Histogram                          m_alert_batch;
+    Histogram                          m_dispatch_time;
+
+    std::string                        m_state_dir;
+
+    std::mutex                         m_profile_mtx;
+    std::string                        m_profile;
+
+    struct Stream {
+        lt::torrent_handle th;
+        StreamClass cls = StreamClass::background;
+        std::chrono::steady_clock::time_point last_read;
+        int64_t need = 0;       // битрейт, байт/с
+        int64_t rate = 0;       // последняя скорость приёма, байт/с
+        bool missing = false;   // см. stream_active()
+        bool done = false;      // скачано всё нужное (finished/seeding)
+        int limit = -1;         // применённые ограничения, -1 — нет
+        int connections = -1;
+        int buffering = -1;     // см. stream_buffering()
+        BtStatus status{};      // valid = 0, пока не пришёл state_update
+    };
+
+    std::mutex                         m_streams_mtx;
+    std::map<lt::sha1_hash, Stream>   m_streams;
+    int64_t                            m_capacity = 0;  // оценка канала, байт/с
+
+    // Голова — самый свежий торрент; ключ — infohash в hex
+    std::mutex                         m_peers_mtx;
+    std::deque<std::pair<std::string, std::vector<lt::tcp::endpoint>>> m_peers;
 };
 
 #endif // VLC_BITTORRENT_LIBTORRENT_H
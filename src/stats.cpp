@@ -0,0 +1,64 @@
+/*
+ * src/stats.cpp
+ *
+ * Квантили — с точностью до бакета (степени двойки): чтобы отличить
+ * миллисекунды очереди алертов от секунд ожидания сети, этого хватает.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cstdio>
+
+#include "stats.h"
+
+void Histogram::record(uint64_t v)
+{
+    int b = 0;
+    for (uint64_t x = v; x != 0 && b < BUCKETS - 1; x >>= 1)
+        b++;
+    m_buckets[b].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(v, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (v > max && !m_max.compare_exchange_weak(max, v, std::memory_order_relaxed))
+        ;
+}
+
+uint64_t Histogram::percentile(double q) const
+{
+    uint64_t n = count();
+    if (n == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)n);
+    uint64_t seen = 0;
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += m_buckets[b].load(std::memory_order_relaxed);
+        if (seen > rank)
+            return b == BUCKETS - 1 ? max : std::min(((uint64_t)1 << b) - 1, max);
+    }
+    return max;
+}
+
+std::string Histogram::format(const char* name, bool duration) const
+{
+    uint64_t n = count();
+    double avg = n ? (double)m_sum.load(std::memory_order_relaxed) / (double)n : 0.0;
+    double scale = duration ? 1000.0 : 1.0;
+    const char* unit = duration ? "ms" : "";
+
+    char buf[192];
+    snprintf(buf, sizeof(buf),
+             "%s n=%llu avg=%.1f%s p50=%.1f%s p99=%.1f%s max=%.1f%s",
+             name, (unsigned long long)n,
+             avg / scale, unit,
+             (double)percentile(0.50) / scale, unit,
+             (double)percentile(0.99) / scale, unit,
+             (double)m_max.load(std::memory_order_relaxed) / scale, unit);
+    return buf;
+}
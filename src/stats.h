@@ -0,0 +1,81 @@
+/*
+ * src/stats.h
+ *
+ * Гистограммы стадий пути чтения: ожидание куска из сети, алерт
+ * read_piece, разбор очереди алертов, обновление приоритетов. Запись —
+ * пара relaxed-атомиков, без блокировок и выделения памяти, поэтому
+ * гистограммы включены всегда, а не только в отладочной сборке. По ним
+ * зависание на месте можно отнести к сети, диску или потоку сессии.
+ *
+ * Текст со всеми гистограммами пишется в журнал при закрытии потока:
+ * собирать его по ходу чтения — строки и snprintf в pf_block.
+ */
+
+#ifndef VLC_BITTORRENT_STATS_H
+#define VLC_BITTORRENT_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+class Histogram {
+public:
+    // Бакет i — значения с i значащими битами, [2^(i-1), 2^i); в
+    // последний попадает всё, что больше. Для длительностей — мкс
+    static const int BUCKETS = 28;
+
+    void
+    record(uint64_t v);
+
+    void
+    record(std::chrono::steady_clock::duration d)
+    {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        record(us > 0 ? (uint64_t)us : 0);
+    }
+
+    uint64_t
+    count() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    // Верхняя граница бакета с квантилем q, не больше максимума;
+    // 0 — записей нет
+    uint64_t
+    percentile(double q) const;
+
+    // "name n=… avg=… p50=… p99=… max=…"; duration — значения в мкс,
+    // печатаются в мс
+    std::string
+    format(const char* name, bool duration) const;
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS] = {};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_max{0};
+};
+
+// Длительность области видимости — в гистограмму
+class StageTimer {
+public:
+    explicit StageTimer(Histogram& h)
+        : m_h(h), m_start(std::chrono::steady_clock::now())
+    {}
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer()
+    {
+        m_h.record(std::chrono::steady_clock::now() - m_start);
+    }
+
+private:
+    Histogram& m_h;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * src/status.h
+ *
+ * Снимок статуса торрента для оверлея и доска, через которую он
+ * передаётся. Пишет только поток сессии (по state_update_alert), читают
+ * DataBlock и Render оверлея — без блокировок и выделения памяти:
+ * доска — это seqlock поверх атомарных слов.
+ *
+ * Оверлей собран отдельным модулем, поэтому адрес доски передаётся через
+ * переменную libVLC STATUS_BOARD_VAR (VLC_VAR_ADDRESS). Заголовок
+ * используется обоими модулями, раскладка StatusBoard у них общая.
+ */
+
+#ifndef VLC_BITTORRENT_STATUS_H
+#define VLC_BITTORRENT_STATUS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#define STATUS_BOARD_VAR "bt_status_board"
+
+struct BtStatus {
+    int32_t  valid;             // 0 — смотреть нечего, оверлей пуст
+    int32_t  has_status;        // 0 — торрент добавлен, статуса ещё нет
+    int32_t  state;             // lt::torrent_status::state_t
+    int32_t  peers;
+    int32_t  buffering_pct;     // чтение ждёт кусок; -1 — не ждёт
+    int64_t  download_rate;     // байт/с
+    int64_t  upload_rate;       // байт/с
+    double   progress_pct;      // 0..100
+};
+
+class StatusBoard {
+public:
+    // Только из одного потока-писателя
+    void
+    publish(const BtStatus& st)
+    {
+        uint64_t w[WORDS] = {};
+        std::memcpy(w, &st, sizeof(st));
+
+        uint32_t seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++)
+            m_words[i].store(w[i], std::memory_order_relaxed);
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // false — снимка ещё не было или писатель слишком долго мешал
+    bool
+    read(BtStatus& st) const
+    {
+        for (int attempt = 0; attempt < 16; attempt++) {
+            uint32_t seq = m_seq.load(std::memory_order_acquire);
+            if (seq & 1)
+                continue;
+            uint64_t w[WORDS];
+            for (size_t i = 0; i < WORDS; i++)
+                w[i] = m_words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_seq.load(std::memory_order_relaxed) != seq)
+                continue;
+            if (seq == 0)
+                return false;
+            std::memcpy(&st, w, sizeof(st));
+            return true;
+        }
+        return false;
+    }
+
+    // Меняется при каждой публикации
+    uint32_t
+    version() const
+    {
+        return m_seq.load(std::memory_order_acquire) / 2;
+    }
+
+private:
+    static_assert(std::is_trivially_copyable<BtStatus>::value,
+                  "BtStatus is copied word by word");
+    static const size_t WORDS = (sizeof(BtStatus) + 7) / 8;
+
+    std::atomic<uint32_t> m_seq{0};
+    std::atomic<uint64_t> m_words[WORDS] = {};
+};
+
+#endif
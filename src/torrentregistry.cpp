@@ -0,0 +1,92 @@
+/*
+ * src/torrentregistry.cpp
+ *
+ * Реализация реестра разобранных метаданных. Держит сильные ссылки на
+ * несколько последних торрентов: между открытием magnet-ссылки, списком
+ * файлов и открытием потока их больше никто не держит.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdexcept>
+
+#include "torrentregistry.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <libtorrent/hasher.hpp>
+#pragma GCC diagnostic pop
+
+#define REGISTRY_SIZE 16
+
+static lt::sha1_hash
+digest_of(const char* data, size_t len)
+{
+    return lt::hasher(data, (int)len).final();
+}
+
+TorrentRegistry& TorrentRegistry::get()
+{
+    static TorrentRegistry inst;
+    return inst;
+}
+
+std::shared_ptr<const lt::torrent_info>
+TorrentRegistry::parse(const char* data, size_t len)
+{
+    TorrentRegistry& r = get();
+    lt::sha1_hash digest = digest_of(data, len);
+
+    {
+        std::lock_guard<std::mutex> lg(r.m_mtx);
+        for (auto it = r.m_entries.begin(); it != r.m_entries.end(); ++it) {
+            if (it->digest == digest) {
+                r.m_entries.splice(r.m_entries.begin(), r.m_entries, it);
+                return it->ti;
+            }
+        }
+    }
+
+    // Разбор — без блокировки: большие торренты разбираются долго
+    lt::error_code ec;
+    auto ti = std::make_shared<lt::torrent_info>(data, (int)len, std::ref(ec));
+    if (ec)
+        throw std::runtime_error("Failed to parse metadata");
+
+    std::lock_guard<std::mutex> lg(r.m_mtx);
+    r.insert(digest, ti);
+    return ti;
+}
+
+void
+TorrentRegistry::add(const char* data, size_t len,
+                     std::shared_ptr<const lt::torrent_info> ti)
+{
+    if (!ti)
+        return;
+
+    TorrentRegistry& r = get();
+    lt::sha1_hash digest = digest_of(data, len);
+
+    std::lock_guard<std::mutex> lg(r.m_mtx);
+    r.insert(digest, std::move(ti));
+}
+
+void
+TorrentRegistry::insert(const lt::sha1_hash& digest,
+                        std::shared_ptr<const lt::torrent_info> ti)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->digest == digest) {
+            m_entries.erase(it);
+            break;
+        }
+    }
+
+    m_entries.push_front(Entry { digest, std::move(ti) });
+    while (m_entries.size() > REGISTRY_SIZE)
+        m_entries.pop_back();
+}
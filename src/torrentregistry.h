@@ -0,0 +1,57 @@
+/*
+ * src/torrentregistry.h
+ *
+ * Общий на процесс реестр разобранных метаданных. Одни и те же байты
+ * .torrent проходят через несколько модулей (magnet-доступ, список
+ * файлов, извлечение потока); вместо разбора в каждом из них
+ * torrent_info ищется по SHA-1 от сырых байтов — это на порядки дешевле
+ * bdecode и построения дерева файлов.
+ */
+
+#ifndef VLC_BITTORRENT_TORRENTREGISTRY_H
+#define VLC_BITTORRENT_TORRENTREGISTRY_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <libtorrent/sha1_hash.hpp>
+#include <libtorrent/torrent_info.hpp>
+#pragma GCC diagnostic pop
+
+namespace lt = libtorrent;
+
+class TorrentRegistry {
+public:
+    // Разобранные метаданные для этих байтов; разбирает при промахе.
+    // Бросает std::runtime_error, если метаданные битые
+    static std::shared_ptr<const lt::torrent_info>
+    parse(const char* data, size_t len);
+
+    // Зарегистрировать уже разобранные метаданные под их байтами
+    static void
+    add(const char* data, size_t len, std::shared_ptr<const lt::torrent_info> ti);
+
+private:
+    struct Entry {
+        lt::sha1_hash digest;
+        std::shared_ptr<const lt::torrent_info> ti;
+    };
+
+    static TorrentRegistry& get();
+
+    // Вызывается с захваченным m_mtx
+    void
+    insert(const lt::sha1_hash& digest, std::shared_ptr<const lt::torrent_info> ti);
+
+    std::mutex m_mtx;
+
+    // Голова — самые свежие; записей немного, поиск линейный
+    std::list<Entry> m_entries;
+};
+
+#endif
@@ -17,6 +17,7 @@
 #include "config.h"
 #endif
 
+#include <algorithm>
 #include <cerrno>
 #include <memory>
 #include <stdexcept>
@@ -134,3 +135,103 @@ get_keep_files(vlc_object_t* p_this)
 {
     return var_InheritBool(p_this, KEEP_CONFIG);
 }
+
+size_t
+get_piece_cache_size(vlc_object_t* p_this)
+{
+    int64_t mib = var_InheritInteger(p_this, CACHE_CONFIG);
+    if (mib < 0)
+        mib = 0;
+    return (size_t) mib * 1024 * 1024;
+}
+
+bool
+get_partial_pieces(vlc_object_t* p_this)
+{
+    return var_InheritBool(p_this, PARTIAL_CONFIG);
+}
+
+bool
+get_prefetch_metadata(vlc_object_t* p_this)
+{
+    return var_InheritBool(p_this, PREFETCH_CONFIG);
+}
+
+std::string
+get_profile(vlc_object_t* p_this)
+{
+    std::unique_ptr<char, decltype(&free)> profile(
+        var_InheritString(p_this, PROFILE_CONFIG), free);
+    return profile ? std::string(profile.get()) : std::string("default");
+}
+
+int
+get_next_file_prefetch(vlc_object_t* p_this)
+{
+    int64_t pct = var_InheritInteger(p_this, NEXTFILE_CONFIG);
+    return (int)std::max<int64_t>(0, std::min<int64_t>(pct, 100));
+}
+
+bool
+get_memory_storage(vlc_object_t* p_this)
+{
+    std::unique_ptr<char, decltype(&free)> mode(
+        var_InheritString(p_this, STORAGE_CONFIG), free);
+    return mode && strcmp(mode.get(), "memory") == 0;
+}
+
+size_t
+get_memory_limit(vlc_object_t* p_this)
+{
+    int64_t mib = var_InheritInteger(p_this, MEMLIMIT_CONFIG);
+    if (mib < 16)
+        mib = 16;
+    return (size_t) mib * 1024 * 1024;
+}
+
+std::vector<std::string>
+get_playlist_magnets(vlc_object_t* p_this)
+{
+    std::vector<std::string> magnets;
+
+    playlist_t* p_playlist = pl_Get(p_this);
+    if (!p_playlist)
+        return magnets;
+
+    playlist_Lock(p_playlist);
+    for (int i = 0; i < p_playlist->items.i_size; i++) {
+        playlist_item_t* p_item = p_playlist->items.p_elems[i];
+        if (!p_item || !p_item->p_input)
+            continue;
+        char* psz_uri = input_item_GetURI(p_item->p_input);
+        if (psz_uri && strncmp(psz_uri, "magnet:", 7) == 0)
+            magnets.emplace_back(psz_uri);
+        free(psz_uri);
+    }
+    playlist_Unlock(p_playlist);
+
+    return magnets;
+}
+
+bool
+read_stream(stream_t* s, std::vector<char>& data, size_t limit)
+{
+    const size_t chunk = 0x10000;
+
+    data.clear();
+    for (;;) {
+        size_t off = data.size();
+        if (off > limit)
+            return false;
+        data.resize(off + chunk);
+        ssize_t n = vlc_stream_Read(s, data.data() + off, chunk);
+        if (n < 0) {
+            data.clear();
+            return false;
+        }
+        data.resize(off + (size_t)n);
+        if (n == 0)
+            break;
+    }
+    return data.size() <= limit;
+}
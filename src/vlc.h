@@ -6,6 +6,7 @@
 #endif
 
 #include <string>
+#include <vector>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-conversion"
@@ -46,9 +47,33 @@
 
 #define DLDIR_CONFIG  "bittorrent-download-path"
 #define KEEP_CONFIG   "bittorrent-keep-files"
+#define CACHE_CONFIG  "bittorrent-piece-cache"
+#define PARTIAL_CONFIG "bittorrent-partial-pieces"
+#define PREFETCH_CONFIG "bittorrent-prefetch-metadata"
+#define PROFILE_CONFIG "bittorrent-profile"
+#define NEXTFILE_CONFIG "bittorrent-next-file-prefetch"
+#define STORAGE_CONFIG "bittorrent-storage"
+#define MEMLIMIT_CONFIG "bittorrent-memory-limit"
+
+// Верхняя граница размера файла .torrent
+#define METADATA_MAX_SIZE (64 * 1024 * 1024)
 
 std::string get_download_directory(vlc_object_t* p_this);
 std::string get_cache_directory   (vlc_object_t* p_this);
 bool        get_keep_files        (vlc_object_t* p_this);
+size_t      get_piece_cache_size  (vlc_object_t* p_this);
+bool        get_partial_pieces    (vlc_object_t* p_this);
+bool        get_prefetch_metadata (vlc_object_t* p_this);
+std::string get_profile           (vlc_object_t* p_this);
+int         get_next_file_prefetch(vlc_object_t* p_this);
+bool        get_memory_storage    (vlc_object_t* p_this);
+size_t      get_memory_limit      (vlc_object_t* p_this);
+
+// Читает поток целиком (не больше limit байт); false — ошибка чтения
+// или поток длиннее limit
+bool read_stream(stream_t* s, std::vector<char>& data, size_t limit);
+
+// magnet-ссылки из текущего плейлиста
+std::vector<std::string> get_playlist_magnets(vlc_object_t* p_this);
 
 #endif /* VLC_BITTORRENT_VLC_H */
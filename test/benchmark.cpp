@@ -0,0 +1,288 @@
+/*
+ * test/benchmark.cpp
+ *
+ * Измерение пути чтения Download на локальном рое (см. benchmark.sh):
+ * время до первого байта, задержка от перемотки до данных (p50/p99),
+ * устойчивая скорость и число read_piece. Шаблоны доступа повторяют то,
+ * как читает VLC: последовательное воспроизведение, случайные перемотки,
+ * MP4 с moov в конце файла, или записанная трасса.
+ *
+ * Результат — одна строка JSON на stdout.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "download.h"
+#include "session.h"
+#include "torrentregistry.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+// seek: перемотка на off, следующие read меряются как «перемотка → данные»
+struct Op {
+    bool seek;
+    int64_t off;
+    int64_t len;
+};
+
+static double
+ms_since(bench_clock::time_point t)
+{
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - t).count();
+}
+
+static double
+percentile(std::vector<double> v, double q)
+{
+    if (v.empty())
+        return 0.0;
+    std::sort(v.begin(), v.end());
+    size_t i = (size_t)(q * (double)(v.size() - 1) + 0.5);
+    return v[std::min(i, v.size() - 1)];
+}
+
+static std::vector<Op>
+pattern_sequential(int64_t filesz, int64_t limit)
+{
+    return { { true, 0, 0 }, { false, 0, std::min(filesz, limit) } };
+}
+
+static std::vector<Op>
+pattern_seek(int64_t filesz, int64_t block, int seeks, unsigned seed)
+{
+    std::vector<Op> ops;
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<int64_t> pos(0, std::max<int64_t>(0, filesz - block));
+    for (int i = 0; i < seeks; i++) {
+        int64_t off = pos(rng) / block * block;
+        ops.push_back({ true, off, 0 });
+        ops.push_back({ false, off, std::min(block, filesz - off) });
+    }
+    return ops;
+}
+
+// Как демультиплексор MP4: заголовок, прыжок к moov в конце, обратно
+// к данным в начале
+static std::vector<Op>
+pattern_moov(int64_t filesz)
+{
+    int64_t head = std::min<int64_t>(64 * 1024, filesz);
+    int64_t tail = std::min<int64_t>(std::max<int64_t>(filesz / 20, 1024 * 1024), filesz);
+    int64_t data = std::min<int64_t>(4 * 1024 * 1024, filesz - head);
+    return { { true, 0, 0 }, { false, 0, head },
+             { true, filesz - tail, 0 }, { false, filesz - tail, tail },
+             { true, head, 0 }, { false, head, data } };
+}
+
+// Строки трассы: "seek OFF" или "read OFF LEN"
+static std::vector<Op>
+pattern_trace(const std::string& path)
+{
+    std::vector<Op> ops;
+    std::ifstream is(path);
+    std::string line;
+    while (std::getline(is, line)) {
+        std::istringstream ls(line);
+        std::string op;
+        Op o { false, 0, 0 };
+        if (!(ls >> op >> o.off))
+            continue;
+        if (op == "seek")
+            o.seek = true;
+        else if (op != "read" || !(ls >> o.len))
+            continue;
+        ops.push_back(o);
+    }
+    return ops;
+}
+
+static int
+usage(const char* argv0)
+{
+    std::cerr << "Usage: " << argv0
+              << " [--pattern sequential|seek|moov|trace] [--trace FILE]"
+                 " [--seeks N] [--seed N] [--block BYTES] [--limit BYTES]"
+                 " [--file INDEX] [--peer HOST:PORT]... [--save-path DIR]"
+                 " [--storage disk|memory] [--memory-limit MIB]"
+                 " TORRENT" << std::endl;
+    return 2;
+}
+
+int
+main(int argc, char* argv[])
+{
+    std::string pattern = "sequential";
+    std::string trace;
+    std::string save_path = ".";
+    std::string torrent;
+    int seeks = 50;
+    unsigned seed = 1;
+    int64_t block = 64 * 1024;
+    int64_t limit = INT64_MAX;
+    int file = -1;
+    std::vector<lt::tcp::endpoint> peers;
+    StorageOptions storage;
+    storage.memory_limit = (size_t)256 * 1024 * 1024;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool more = i + 1 < argc;
+        if (arg == "--pattern" && more) {
+            pattern = argv[++i];
+        } else if (arg == "--trace" && more) {
+            trace = argv[++i];
+            pattern = "trace";
+        } else if (arg == "--seeks" && more) {
+            seeks = std::atoi(argv[++i]);
+        } else if (arg == "--seed" && more) {
+            seed = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--block" && more) {
+            block = std::max<int64_t>(1, std::atoll(argv[++i]));
+        } else if (arg == "--limit" && more) {
+            limit = std::atoll(argv[++i]);
+        } else if (arg == "--file" && more) {
+            file = std::atoi(argv[++i]);
+        } else if (arg == "--save-path" && more) {
+            save_path = argv[++i];
+        } else if (arg == "--storage" && more) {
+            std::string mode = argv[++i];
+            if (mode == "memory")
+                storage.mode = StorageMode::memory;
+            else if (mode != "disk")
+                return usage(argv[0]);
+        } else if (arg == "--memory-limit" && more) {
+            storage.memory_limit = (size_t)std::max<int64_t>(1, std::atoll(argv[++i])) * 1024 * 1024;
+        } else if (arg == "--peer" && more) {
+            std::string hp = argv[++i];
+            size_t colon = hp.rfind(':');
+            if (colon == std::string::npos)
+                return usage(argv[0]);
+            boost::system::error_code ec;
+            auto addr = boost::asio::ip::make_address(hp.substr(0, colon), ec);
+            if (ec)
+                return usage(argv[0]);
+            peers.emplace_back(addr, (unsigned short)std::atoi(hp.c_str() + colon + 1));
+        } else if (arg.compare(0, 2, "--") == 0) {
+            return usage(argv[0]);
+        } else {
+            torrent = arg;
+        }
+    }
+    if (torrent.empty())
+        return usage(argv[0]);
+
+    try {
+        std::ifstream is(torrent, std::ios::binary);
+        std::vector<char> md((std::istreambuf_iterator<char>(is)),
+                             std::istreambuf_iterator<char>());
+        auto ti = TorrentRegistry::parse(md.data(), md.size());
+#if LIBTORRENT_VERSION_NUM >= 20000
+        lt::sha1_hash ih = ti->info_hashes().v1;
+#else
+        lt::sha1_hash ih = ti->info_hash();
+#endif
+
+        // Пиры роя подключаются сразу при добавлении торрента, как пиры
+        // из кэша прошлого запуска
+        if (!peers.empty())
+            Session::get()->remember_peers(ih, peers);
+
+        const lt::file_storage& fs = ti->files();
+        if (file < 0) {
+            for (int i = 0; i < fs.num_files(); i++) {
+                if (file < 0 || fs.file_size(i) > fs.file_size(file))
+                    file = i;
+            }
+        }
+        if (file < 0 || file >= fs.num_files())
+            throw std::runtime_error("No such file");
+        int64_t filesz = fs.file_size(file);
+
+        std::vector<Op> ops;
+        if (pattern == "sequential")
+            ops = pattern_sequential(filesz, limit);
+        else if (pattern == "seek")
+            ops = pattern_seek(filesz, block, seeks, seed);
+        else if (pattern == "moov")
+            ops = pattern_moov(filesz);
+        else if (pattern == "trace")
+            ops = pattern_trace(trace);
+        else
+            return usage(argv[0]);
+
+        auto start = bench_clock::now();
+        auto d = Download::get_download(md.data(), md.size(), save_path, save_path, false,
+                                        storage);
+
+        std::vector<char> buf((size_t)block);
+        std::vector<double> seek_ms;
+        double ttfb_ms = -1.0;
+        bench_clock::time_point first_byte;
+        bench_clock::time_point seek_time;
+        bool seek_pending = false;
+        int64_t total = 0;
+
+        for (auto const& op : ops) {
+            if (op.seek) {
+                seek_time = bench_clock::now();
+                seek_pending = true;
+                d->set_playhead(file, op.off);
+                continue;
+            }
+            int64_t done = 0;
+            while (done < op.len) {
+                size_t n = (size_t)std::min<int64_t>(block, op.len - done);
+                ssize_t r = d->read(file, op.off + done, buf.data(), n);
+                if (r <= 0)
+                    break;
+                if (ttfb_ms < 0) {
+                    ttfb_ms = ms_since(start);
+                    first_byte = bench_clock::now();
+                }
+                if (seek_pending) {
+                    seek_ms.push_back(ms_since(seek_time));
+                    seek_pending = false;
+                }
+                done += r;
+            }
+            total += done;
+        }
+
+        double elapsed_ms = ms_since(start);
+        double read_ms = ttfb_ms < 0 ? 0.0 : ms_since(first_byte);
+        DownloadCounters c = d->counters();
+
+        std::printf("{\"pattern\":\"%s\",\"file\":%d,\"file_size\":%lld,"
+                    "\"bytes\":%lld,\"elapsed_ms\":%.1f,\"ttfb_ms\":%.1f,"
+                    "\"seeks\":%zu,\"seek_p50_ms\":%.1f,\"seek_p99_ms\":%.1f,"
+                    "\"throughput_mib_s\":%.3f,\"read_piece_calls\":%llu,"
+                    "\"disk_reads\":%llu,\"cache_hits\":%llu,\"cache_misses\":%llu,"
+                    "\"in_memory\":%s}\n",
+                    pattern.c_str(), file, (long long)filesz, (long long)total,
+                    elapsed_ms, ttfb_ms, seek_ms.size(),
+                    percentile(seek_ms, 0.50), percentile(seek_ms, 0.99),
+                    read_ms > 0 ? (double)total / (1024.0 * 1024.0) / (read_ms / 1000.0) : 0.0,
+                    (unsigned long long)c.read_piece_calls,
+                    (unsigned long long)c.disk_reads,
+                    (unsigned long long)c.cache_hits,
+                    (unsigned long long)c.cache_misses,
+                    d->in_memory() ? "true" : "false");
+        // Гистограммы стадий — для разбора, куда ушло время
+        std::cerr << d->stats_text();
+    } catch (std::runtime_error& e) {
+        std::printf("{\"error\":\"%s\"}\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
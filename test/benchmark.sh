@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+# Локальный рой для benchmark: PEERS сидеров miniclient с данными из
+# DATA_DIR, каждому ограничена отдача, к loopback по желанию добавляется
+# задержка. У libtorrent нет настройки задержки, поэтому она вносится
+# через tc netem (только от root; иначе задержка игнорируется).
+#
+# Запуск из каталога сборки test/:
+#   benchmark.sh [-n PEERS] [-r RATE] [-l LATENCY_MS] [-p PATTERN] \
+#                TORRENT DATA_DIR [-- BENCHMARK_ARGS...]
+# RATE — байт/с на сидера, 0 — без ограничения. Результат — строка JSON.
+
+set -o pipefail
+
+peers=4
+rate=0
+latency=0
+pattern=sequential
+
+while getopts "n:r:l:p:" opt; do
+	case $opt in
+	n) peers=$OPTARG ;;
+	r) rate=$OPTARG ;;
+	l) latency=$OPTARG ;;
+	p) pattern=$OPTARG ;;
+	*) exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+torrent=$1
+data=$2
+shift 2 || exit 2
+[ "$1" = "--" ] && shift
+
+if [ -z "$torrent" ] || [ ! -d "$data" ]; then
+	echo "usage: $0 [-n PEERS] [-r RATE] [-l LATENCY_MS] [-p PATTERN] TORRENT DATA_DIR [-- ARGS...]" >&2
+	exit 2
+fi
+
+port=${BENCHMARK_PORT:-17881}
+save=$(mktemp -d)
+pids=()
+netem=0
+
+cleanup() {
+	[ ${#pids[@]} -gt 0 ] && kill "${pids[@]}" 2>/dev/null
+	wait 2>/dev/null
+	[ $netem -eq 1 ] && tc qdisc del dev lo root 2>/dev/null
+	rm -rf "$save"
+}
+trap cleanup EXIT
+
+args=()
+for ((i = 0; i < peers; i++)); do
+	./miniclient --quiet --port $((port + i)) --upload-limit "$rate" \
+		--save-path "$data" "$torrent" &
+	pids+=($!)
+	args+=(--peer 127.0.0.1:$((port + i)))
+done
+
+if [ "$latency" -gt 0 ]; then
+	if [ "$(id -u)" -eq 0 ] && tc qdisc add dev lo root netem delay "${latency}ms" 2>/dev/null; then
+		netem=1
+	else
+		echo "benchmark.sh: latency needs root and tc netem, ignored" >&2
+	fi
+fi
+
+# Сидерам нужно проверить данные и начать слушать
+sleep 3
+
+./benchmark --pattern "$pattern" --save-path "$save" "${args[@]}" "$@" "$torrent"
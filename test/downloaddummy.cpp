@@ -90,7 +90,7 @@ main(int argc, char* argv[])
     try {
         auto md = Download::get_metadata(argv[1], ".", "/tmp");
 
-        auto d = Download::get_download(md->data(), md->size(), ".", true);
+        auto d = Download::get_download(md->data(), md->size(), ".", "/tmp", true);
 
         if (show_metadata) {
             test_metadata(d);
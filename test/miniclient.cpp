@@ -18,8 +18,13 @@ along with vlc-bittorrent.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <string>
 #include <utility> // for std::move
+#include <vector>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-conversion"
@@ -27,6 +32,9 @@ along with vlc-bittorrent.  If not, see <http://www.gnu.org/licenses/>.
 #include <libtorrent/add_torrent_params.hpp>
 #include <libtorrent/alert.hpp>
 #include <libtorrent/alert_types.hpp>
+#include <libtorrent/bencode.hpp>
+#include <libtorrent/create_torrent.hpp>
+#include <libtorrent/ip_filter.hpp>
 #include <libtorrent/session.hpp>
 #include <libtorrent/torrent_handle.hpp>
 #include <libtorrent/torrent_info.hpp>
@@ -39,9 +47,72 @@ namespace lt = libtorrent;
     (lt::alert::status_notification | lt::alert::progress_notification \
         | lt::alert::error_notification | lt::alert::peer_notification)
 
+// Write a trackerless torrent for SOURCE (a file or a directory) to OUT.
+// Seeders then use the directory SOURCE is in as their save path
+static int
+create(char const* argv0, std::string const& source, std::string const& out)
+{
+    try {
+        lt::file_storage fs;
+        lt::add_files(fs, source);
+        if (fs.num_files() == 0) {
+            std::cerr << argv0 << ": Nothing to add in " << source << std::endl;
+            return 1;
+        }
+
+        lt::create_torrent ct(fs);
+        size_t slash = source.find_last_of('/');
+        lt::set_piece_hashes(ct, slash == std::string::npos ? "." : source.substr(0, slash));
+
+        std::vector<char> buf;
+        lt::bencode(std::back_inserter(buf), ct.generate());
+        std::ofstream os(out, std::ios::binary);
+        os.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        if (!os) {
+            std::cerr << argv0 << ": Failed to write " << out << std::endl;
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << argv0 << ": Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Usage: miniclient [--port N] [--upload-limit BYTES_PER_SEC]
+//                   [--save-path DIR] [--quiet] TORRENT...
+//        miniclient --create SOURCE TORRENT
+//
+// Several instances with different ports and upload limits make a local
+// swarm for the benchmark. --create makes a torrent to seed, e.g. the
+// PGO training data.
 int
 main(int argc, char const* argv[])
 {
+    if (argc == 4 && std::string(argv[1]) == "--create")
+        return create(argv[0], argv[2], argv[3]);
+
+    int port = 0;
+    int upload_limit = 0;
+    bool quiet = false;
+    std::string save_path = ".";
+    std::vector<std::string> torrents;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            port = std::atoi(argv[++i]);
+        } else if (arg == "--upload-limit" && i + 1 < argc) {
+            upload_limit = std::atoi(argv[++i]);
+        } else if (arg == "--save-path" && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (arg == "--quiet") {
+            quiet = true;
+        } else {
+            torrents.push_back(arg);
+        }
+    }
+
     try {
         lt::settings_pack p;
         p.set_int(lt::settings_pack::alert_mask, ALERTS);
@@ -50,14 +121,30 @@ main(int argc, char const* argv[])
         p.set_bool(lt::settings_pack::enable_natpmp, false);
         p.set_bool(lt::settings_pack::enable_dht, false);
         p.set_bool(lt::settings_pack::broadcast_lsd, true);
+        if (port > 0)
+            p.set_str(lt::settings_pack::listen_interfaces,
+                      "0.0.0.0:" + std::to_string(port));
+        if (upload_limit > 0)
+            p.set_int(lt::settings_pack::upload_rate_limit, upload_limit);
 
         lt::session ses(p);
 
-        for (int i = 1; i < argc; i++) {
+        // Peers on the local network are exempt from rate limits by
+        // default. Put everyone in the global class so the limit applies
+        // to a swarm on localhost too
+        if (upload_limit > 0) {
+            lt::ip_filter classes;
+            classes.add_rule(
+                boost::asio::ip::address_v4::any(),
+                boost::asio::ip::address_v4::broadcast(),
+                1u << static_cast<std::uint32_t>(lt::session::global_peer_class_id));
+            ses.set_peer_class_filter(classes);
+        }
+
+        for (auto const& path : torrents) {
             try {
                 lt::add_torrent_params atp;
-                atp.save_path = ".";
-                std::string path = argv[i];
+                atp.save_path = save_path;
 #if LIBTORRENT_VERSION_NUM < 10100
                 atp.ti = new libtorrent::torrent_info(path);
 #elif LIBTORRENT_VERSION_NUM < 10200
@@ -68,7 +155,7 @@ main(int argc, char const* argv[])
 
                 ses.async_add_torrent(atp);
             } catch (const std::exception& e) {
-                std::cerr << argv[0] << ": Failed to add " << argv[i] << ": "
+                std::cerr << argv[0] << ": Failed to add " << path << ": "
                           << e.what() << std::endl;
             }
         }
@@ -79,6 +166,8 @@ main(int argc, char const* argv[])
             ses.wait_for_alert(std::chrono::seconds(1));
             ses.pop_alerts(&alerts);
 
+            if (quiet)
+                continue;
             for (const lt::alert* a : alerts) {
                 std::cout << a->message() << std::endl;
             }
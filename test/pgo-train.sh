@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# Тренировочная нагрузка PGO: benchmark на локальном рое шаблонами,
+# которые проходят горячие пути плагина. Последовательное
+# воспроизведение — read_piece, кэш кусков, упреждающее чтение. Случайные
+# перемотки — окно приоритетов, сроки кусков, разбор алертов. moov в
+# конце файла. Медленный рой — ожидание блоков и буферизация. Хранилище
+# в памяти (на libtorrent 2.0 — обычный диск). Данные — случайный файл
+# SIZE_MB мегабайт, торрент к нему делает miniclient --create.
+#
+# Запуск из каталога сборки test/ с инструментированным benchmark
+# (BITTORRENT_OPTIMIZE=pgo-generate или configure --enable-pgo=generate):
+#   pgo-train.sh [SIZE_MB]
+# Профили копятся в каталоге PGO; Clang их затем сливает
+# llvm-profdata merge, см. scripts/build-optimized.
+
+set -o pipefail
+
+size=${1:-96}
+here=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+mkdir "$work/data"
+head -c $((size * 1024 * 1024)) /dev/urandom > "$work/data/train.bin" || exit 1
+./miniclient --create "$work/data/train.bin" "$work/train.torrent" || exit 1
+
+failed=0
+
+# run [BENCHMARK.SH OPTIONS] [-- BENCHMARK OPTIONS]
+run() {
+	local opts=()
+	while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+		opts+=("$1")
+		shift
+	done
+	echo "pgo-train: ${opts[*]} $*" >&2
+	bash "$here/benchmark.sh" "${opts[@]}" "$work/train.torrent" "$work/data" "$@" \
+		>/dev/null 2>&1 || failed=$((failed + 1))
+}
+
+run -p sequential
+run -p seek -- --seeks 200 --seed 1
+run -p seek -- --seeks 200 --seed 2 --block 16384
+run -p moov
+run -n 2 -r 4194304 -p seek -- --seeks 30 --seed 3
+run -p sequential -- --storage memory --memory-limit 16
+run -p seek -- --storage memory --memory-limit 16 --seeks 100 --seed 4
+
+if [ $failed -gt 0 ]; then
+	echo "pgo-train: $failed runs failed, the profile is incomplete" >&2
+	exit 1
+fi
+exit 0